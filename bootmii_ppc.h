@@ -97,6 +97,10 @@ void sync_before_exec(const void *p, u32 len);
 
 // Time.
 
+// Timebase frequency is bus frequency / 4.  Ignore roundoff, this
+// doesn't have to be very accurate.
+#define TICKS_PER_USEC (243/4)
+
 void udelay(u32 us);
 u64 mftb(void);
 
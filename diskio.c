@@ -15,14 +15,255 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #include "diskio.h"
 #include "string.h"
 
-static u8 *buffer[512] __attribute__((aligned(32)));
+// unaligned requests are staged through here, up to BOUNCE_SECTORS at a time
+#define BOUNCE_SECTORS	128
 
-DSTATUS disk_initialize (BYTE drv)
+static u8 bounce[BOUNCE_SECTORS * 512] MEM2_BSS ALIGNED(64);
+static struct disk_stats stats;
+
+#if _READONLY == 0
+// small writes collect in one of two buffers as long as they extend the
+// same run of sectors; a full or broken run goes out asynchronously while
+// the other buffer takes the next writes. CTRL_SYNC waits for all of it.
+#define WB_SECTORS	128
+
+static struct {
+	ipc_batch batch;
+	u32 sector;
+	u32 count;
+	int busy;
+} wb[2];
+
+static u8 wb_buf[2][WB_SECTORS * 512] MEM2_BSS ALIGNED(64);
+static int wb_cur;
+static int wb_error;
+
+static void wb_reap(int i)
+{
+	if (wb[i].busy) {
+		if (ipc_batch_wait(&wb[i].batch, 0)->args[0] != 0)
+			wb_error = 1;
+		wb[i].busy = 0;
+		wb[i].count = 0;
+	}
+}
+
+// send the collecting buffer to mini and switch to the other one
+static void wb_flush(void)
+{
+	int i = wb_cur;
+
+	if (wb[i].count == 0)
+		return;
+
+	ipc_batch_init(&wb[i].batch);
+	sd_write_async(&wb[i].batch, wb[i].sector, wb[i].count, wb_buf[i]);
+	ipc_batch_submit(&wb[i].batch);
+	wb[i].busy = 1;
+	stats.wb_flushes++;
+	stats.wb_sectors += wb[i].count;
+
+	wb_cur ^= 1;
+	wb_reap(wb_cur);
+}
+
+static int wb_overlaps(u32 sector, u32 count)
+{
+	int i = wb_cur;
+
+	return wb[i].count && sector < wb[i].sector + wb[i].count &&
+		wb[i].sector < sector + count;
+}
+
+static int wb_sync(void)
 {
-	(void) drv;
+	int err;
 
+	wb_flush();
+	wb_reap(0);
+	wb_reap(1);
+
+	err = wb_error;
+	wb_error = 0;
+	return err;
+}
+#endif
+
+// once reads look sequential, the next RA_SECTORS chunks are kept in flight
+// to mini so the SD transfer overlaps whatever the caller does in between
+#define RA_SECTORS	128
+#define RA_BUFFERS	2
+#define RA_STREAK	2
+
+#define RA_EMPTY	0
+#define RA_BUSY		1
+#define RA_READY	2
+
+static struct {
+	ipc_batch batch;
+	u32 sector;
+	u32 count;
+	u32 used;
+	int state;
+} ra[RA_BUFFERS];
+
+static u8 ra_buf[RA_BUFFERS][RA_SECTORS * 512] MEM2_BSS ALIGNED(64);
+static u32 ra_next;		// sector the current stream continues at
+static u32 ra_streak;	// sequential reads in a row
+static u32 last_end;	// end of the previous read
+static u32 disk_sectors;
+
+static int ra_wait(int i)
+{
+	if (ra[i].state == RA_BUSY) {
+		if (ipc_batch_wait(&ra[i].batch, 0)->args[0] != 0)
+			ra[i].state = RA_EMPTY;
+		else
+			ra[i].state = RA_READY;
+	}
+
+	return ra[i].state == RA_READY;
+}
+
+static int ra_find(u32 sector)
+{
+	int i;
+
+	for (i = 0; i < RA_BUFFERS; i++)
+		if (ra[i].state != RA_EMPTY && sector >= ra[i].sector &&
+				sector < ra[i].sector + ra[i].count)
+			return i;
+
+	return -1;
+}
+
+static void ra_release(int i)
+{
+	ra_wait(i);
+	if (ra[i].state == RA_READY && ra[i].used < ra[i].count)
+		stats.ra_wasted++;
+	ra[i].state = RA_EMPTY;
+}
+
+// forget whatever overlaps [sector, sector+count); count 0 drops everything
+static void ra_drop(u32 sector, u32 count)
+{
+	int i;
+
+	for (i = 0; i < RA_BUFFERS; i++) {
+		if (ra[i].state == RA_EMPTY)
+			continue;
+		if (count == 0 || (sector < ra[i].sector + ra[i].count &&
+				ra[i].sector < sector + count))
+			ra_release(i);
+	}
+}
+
+static int ra_start(u32 sector)
+{
+	int i, victim = -1;
+
+	if (!disk_sectors)
+		disk_sectors = sd_getsize();
+	if (sector >= disk_sectors)
+		return 0;
+
+#if _READONLY == 0
+	// mini handles requests in order, so posting the buffered writes
+	// first is enough for the read-ahead to see them
+	if (wb_overlaps(sector, RA_SECTORS))
+		wb_flush();
+#endif
+
+	// a free buffer, or else the lowest one that the stream has already
+	// left behind or will not reach; judged from ra_next, where the
+	// stream reads now, since sector may lie a whole chunk beyond it
+	for (i = 0; i < RA_BUFFERS; i++) {
+		if (ra[i].state == RA_EMPTY) {
+			victim = i;
+			break;
+		}
+		if (ra[i].sector + ra[i].count > ra_next &&
+				ra[i].sector < ra_next + RA_BUFFERS * RA_SECTORS)
+			continue;
+		if (victim < 0 || ra[i].sector < ra[victim].sector)
+			victim = i;
+	}
+	if (victim < 0)
+		return 0;
+	if (ra[victim].state != RA_EMPTY)
+		ra_release(victim);
+
+	ra[victim].sector = sector;
+	ra[victim].count = RA_SECTORS;
+	if (ra[victim].count > disk_sectors - sector)
+		ra[victim].count = disk_sectors - sector;
+	ra[victim].used = 0;
+	ra[victim].state = RA_BUSY;
+
+	ipc_batch_init(&ra[victim].batch);
+	sd_read_async(&ra[victim].batch, sector, ra[victim].count, ra_buf[victim]);
+	ipc_batch_submit(&ra[victim].batch);
+	stats.ra_issued++;
+
+	return 1;
+}
+
+// keep the chunks following sector in flight
+static void ra_ahead(u32 sector)
+{
+	int i, k;
+
+	for (k = 0; k < RA_BUFFERS; k++) {
+		i = ra_find(sector);
+		if (i < 0) {
+			if (!ra_start(sector))
+				return;
+			i = ra_find(sector);
+		}
+		sector = ra[i].sector + ra[i].count;
+	}
+}
+
+// copy the front of a request out of the read-ahead buffers
+static void ra_serve(BYTE **buff, DWORD *sector, u32 *count)
+{
+	u32 off, n;
+	int i;
+
+	while (*count > 0 && (i = ra_find(*sector)) >= 0) {
+		if (!ra_wait(i))
+			continue;
+
+		off = *sector - ra[i].sector;
+		n = ra[i].count - off;
+		if (n > *count)
+			n = *count;
+
+		memcpy(*buff, ra_buf[i] + off * 512, n * 512);
+		*buff += n * 512;
+		*sector += n;
+		*count -= n;
+		stats.ra_sectors += n;
+
+		ra[i].used += n;
+		if (off + n == ra[i].count)
+			ra[i].state = RA_EMPTY;
+	}
+}
+
+static DSTATUS sd_disk_initialize(void)
+{
 	int state = sd_get_state();
 
+	ra_drop(0, 0);
+#if _READONLY == 0
+	wb_sync();
+#endif
+	ra_streak = 0;
+	ra_next = last_end = ~0;
+	disk_sectors = 0;
+
 	switch (state) {
 	case SDMMC_NO_CARD:
 		return STA_NODISK;
@@ -38,10 +279,8 @@ DSTATUS disk_initialize (BYTE drv)
 	}
 }
 
-DSTATUS disk_status (BYTE drv)
+static DSTATUS sd_disk_status(void)
 {
-	(void) drv;
-
 	int state = sd_get_state();
 
 	switch (state) {
@@ -56,68 +295,248 @@ DSTATUS disk_status (BYTE drv)
 	}
 }
 
-DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, u32 count)
+static void count_request(BYTE *buff, u32 count)
+{
+	if (count == 1)
+		stats.single++;
+	else if (((u32) buff % 64) == 0)
+		stats.aligned++;
+	else
+		stats.bounced++;
+}
+
+static DRESULT sd_disk_read(BYTE *buff, DWORD sector, u32 count)
 {
-	u32 i;
-	DRESULT res;
-	(void) drv;
+	u32 n;
+#if _READONLY == 0
+	BYTE *obuff = buff;
+	DWORD osector = sector;
+	u32 ocount = count, first, last;
+#endif
+
+	count_request(buff, count);
+
+	// single FAT/directory reads in between don't break a stream, two
+	// back to back reads start a new one
+	if (sector == ra_next) {
+		ra_streak++;
+		ra_next = sector + count;
+	} else if (sector == last_end) {
+		ra_streak = RA_STREAK;
+		ra_next = sector + count;
+	}
+	last_end = sector + count;
+
+	ra_serve(&buff, &sector, &count);
 
-	if (count > 1 && ((u32) buff % 64) == 0) {
+	if (count == 0) {
+		// nothing left to do
+	} else if (((u32) buff % 64) == 0) {
+		// mini DMAs straight into the caller's buffer if it is aligned
 		if (sd_read(sector, count, buff) != 0)
 			return RES_ERROR;
-		return RES_OK;
-	}
+	} else {
+		while (count > 0) {
+			n = count > BOUNCE_SECTORS ? BOUNCE_SECTORS : count;
+			if (sd_read(sector, n, bounce) != 0)
+				return RES_ERROR;
 
-	res = RES_OK;
-	for (i = 0; i < count; i++) {
-		if (sd_read(sector + i, 1, buffer) != 0) {
-			res = RES_ERROR;
-			break;
+			memcpy(buff, bounce, n * 512);
+			buff += n * 512;
+			sector += n;
+			count -= n;
 		}
+	}
 
-		memcpy(buff + i * 512, buffer, 512);
+#if _READONLY == 0
+	// sectors still sitting in the write buffer are newer than the card
+	if (wb_overlaps(osector, ocount)) {
+		first = osector > wb[wb_cur].sector ? osector : wb[wb_cur].sector;
+		last = osector + ocount;
+		if (last > wb[wb_cur].sector + wb[wb_cur].count)
+			last = wb[wb_cur].sector + wb[wb_cur].count;
+		memcpy(obuff + (first - osector) * 512,
+			wb_buf[wb_cur] + (first - wb[wb_cur].sector) * 512,
+			(last - first) * 512);
 	}
+#endif
 
-	return res;
+	if (ra_streak >= RA_STREAK && last_end == ra_next)
+		ra_ahead(ra_next);
+
+	return RES_OK;
 }
 
 #if _READONLY == 0
-DRESULT disk_write (BYTE drv, const BYTE *buff,	DWORD sector, u32 count)
+static DRESULT sd_disk_write(const BYTE *buff, DWORD sector, u32 count)
 {
-	u32 i;
-	DRESULT res;
-	(void) drv;
+	u32 n;
+	int i;
+
+	count_request((BYTE *) buff, count);
+	ra_drop(sector, count);
+
+	// a failed write-behind is reported on the next write or sync
+	if (wb_error) {
+		wb_error = 0;
+		return RES_ERROR;
+	}
+
+	if (count < WB_SECTORS) {
+		i = wb_cur;
+		if (wb[i].count && (sector < wb[i].sector ||
+				sector > wb[i].sector + wb[i].count ||
+				sector + count - wb[i].sector > WB_SECTORS)) {
+			wb_flush();
+			i = wb_cur;
+		}
+		if (wb[i].count == 0)
+			wb[i].sector = sector;
+
+		memcpy(wb_buf[i] + (sector - wb[i].sector) * 512, buff, count * 512);
+		if (sector + count - wb[i].sector > wb[i].count)
+			wb[i].count = sector + count - wb[i].sector;
+		stats.wb_merged++;
+		return RES_OK;
+	}
+
+	// large writes go straight out, behind any older data for the same sectors
+	if (wb_overlaps(sector, count))
+		wb_flush();
 
-	res = RES_OK;
-	if (count > 1 && ((u32) buff % 64) == 0) {
+	if (((u32) buff % 64) == 0) {
 		if (sd_write(sector, count, buff) != 0)
 			return RES_ERROR;
 		return RES_OK;
 	}
 
-	for (i = 0; i < count; i++) {
-		memcpy(buffer, buff + i * 512, 512);
-		if (sd_write(sector + i, 1, buffer) != 0) {
-			res = RES_ERROR;
-			break;
-		}
+	while (count > 0) {
+		n = count > BOUNCE_SECTORS ? BOUNCE_SECTORS : count;
+		memcpy(bounce, buff, n * 512);
+		if (sd_write(sector, n, bounce) != 0)
+			return RES_ERROR;
+
+		buff += n * 512;
+		sector += n;
+		count -= n;
 	}
 
-	return res;
+	return RES_OK;
 }
 #endif /* _READONLY */
 
+static DRESULT sd_disk_sync(void)
+{
+#if _READONLY == 0
+	// everything written so far is on the card when this returns
+	if (wb_sync())
+		return RES_ERROR;
+#endif
+	return RES_OK;
+}
+
+static u32 sd_disk_sectors(void)
+{
+	return sd_getsize();
+}
+
+static const struct disk_ops sd_disk = {
+	.name		= "sd",
+	.initialize	= sd_disk_initialize,
+	.status		= sd_disk_status,
+	.read		= sd_disk_read,
+#if _READONLY == 0
+	.write		= sd_disk_write,
+#endif
+	.sync		= sd_disk_sync,
+	.sectors	= sd_disk_sectors,
+};
+
+static const struct disk_ops *disks[DISK_MAX] = {
+	[DISK_SD] = &sd_disk,
+};
+
+int disk_register(BYTE drv, const struct disk_ops *ops)
+{
+	if (drv >= DISK_MAX)
+		return -1;
+
+	disks[drv] = ops;
+	return 0;
+}
+
+const struct disk_ops *disk_get(BYTE drv)
+{
+	if (drv >= DISK_MAX)
+		return NULL;
+
+	return disks[drv];
+}
+
+DSTATUS disk_initialize (BYTE drv)
+{
+	if (drv >= DISK_MAX || !disks[drv])
+		return STA_NOINIT | STA_NODISK;
+
+	return disks[drv]->initialize();
+}
+
+DSTATUS disk_status (BYTE drv)
+{
+	if (drv >= DISK_MAX || !disks[drv])
+		return STA_NOINIT | STA_NODISK;
+
+	return disks[drv]->status();
+}
+
+DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, u32 count)
+{
+	if (drv >= DISK_MAX || !disks[drv])
+		return RES_PARERR;
+
+	stats.calls++;
+	stats.sectors += count;
+	return disks[drv]->read(buff, sector, count);
+}
+
+#if _READONLY == 0
+DRESULT disk_write (BYTE drv, const BYTE *buff,	DWORD sector, u32 count)
+{
+	if (drv >= DISK_MAX || !disks[drv])
+		return RES_PARERR;
+	if (!disks[drv]->write)
+		return RES_WRPRT;
+
+	stats.calls++;
+	stats.sectors += count;
+	return disks[drv]->write(buff, sector, count);
+}
+#endif /* _READONLY */
+
+void disk_get_stats(struct disk_stats *st)
+{
+	memcpy(st, &stats, sizeof(stats));
+}
+
+void disk_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
 DRESULT disk_ioctl (BYTE drv, BYTE ctrl, void *buff)
 {
-	(void) drv;
 	u32 *buff_u32 = (u32 *) buff;
 	DRESULT res = RES_OK;
 
+	if (drv >= DISK_MAX || !disks[drv])
+		return RES_PARERR;
+
 	switch (ctrl) {
 	case CTRL_SYNC:
+		res = disks[drv]->sync();
 		break;
 	case GET_SECTOR_COUNT:
-		*buff_u32 = sd_getsize();
+		*buff_u32 = disks[drv]->sectors();
 		break;
 	case GET_SECTOR_SIZE:
 		*buff_u32 = 512;
@@ -34,6 +34,45 @@ DRESULT disk_ioctl (BYTE, BYTE, void*);
 
 DWORD get_fattime(void);
 
+/* Physical drives */
+#define DISK_SD		0
+#define DISK_USB	1
+#define DISK_RAM	2
+#define DISK_MAX	3
+
+/* A block device behind disk_*; sectors are always 512 bytes. write may be
+   NULL for read-only devices. */
+struct disk_ops {
+	const char *name;
+	DSTATUS (*initialize)(void);
+	DSTATUS (*status)(void);
+	DRESULT (*read)(BYTE *buff, DWORD sector, u32 count);
+	DRESULT (*write)(const BYTE *buff, DWORD sector, u32 count);
+	DRESULT (*sync)(void);
+	u32 (*sectors)(void);
+};
+
+int disk_register(BYTE drv, const struct disk_ops *ops);
+const struct disk_ops *disk_get(BYTE drv);
+
+/* SD request counters, by the path disk_read/disk_write took */
+struct disk_stats {
+	u32 calls;	/* disk_read/disk_write calls on any drive */
+	u32 sectors;	/* total sectors transferred on any drive */
+	u32 aligned;	/* multi-sector, straight into the caller's buffer */
+	u32 bounced;	/* multi-sector, through the aligned bounce buffer */
+	u32 single;	/* one sector (FAT/directory window traffic) */
+	u32 ra_issued;	/* read-ahead chunks sent to mini */
+	u32 ra_sectors;	/* sectors served from read-ahead */
+	u32 ra_wasted;	/* chunks dropped before they were used up */
+	u32 wb_merged;	/* small writes taken by the write-behind buffer */
+	u32 wb_flushes;	/* write-behind runs sent to the card */
+	u32 wb_sectors;	/* sectors in those runs */
+};
+
+void disk_get_stats(struct disk_stats *st);
+void disk_reset_stats(void);
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
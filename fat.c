@@ -8,16 +8,76 @@ Copyright (C) 2009		Andre Heider "dhewg" <dhewg@wiibrew.org>
 # see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
 */
 
+#include "bootmii_ppc.h"
 #include "fat.h"
+#include "string.h"
 
-static FATFS fatfs;
+// one bit per cluster covers 2M clusters, i.e. 64GB with 32KB clusters
+#define FAT_FMAP_WORDS	(64 * 1024)
+
+// fat_copy moves data in chunks this big
+#define FAT_COPY_CHUNK	(512 * 1024)
+
+PARTITION Drives[_DRIVES];
+
+static FATFS fatfs[_DRIVES];
+static DWORD fatfs_fmap[_DRIVES][FAT_FMAP_WORDS] MEM2_BSS;
+static u8 copy_buf[FAT_COPY_CHUNK] MEM2_BSS ALIGNED(64);
+static u8 mbr[512] ALIGNED(64);
+static u8 mounted[_DRIVES];
+static u32 volumes;
+
+static void umount_volume(BYTE ld)
+{
+	f_mount(ld, NULL);
+	memset(&Drives[ld], 0, sizeof(Drives[ld]));
+	mounted[ld] = 0;
+}
+
+// f_mount only registers the work area, the volume itself is mounted on
+// first access. with probe set, access it right away and back out if it
+// isn't a usable FAT volume.
+static u32 mount_volume(BYTE ld, BYTE pd, BYTE pt, int probe)
+{
+	char root[3] = { '0' + ld, ':', 0 };
+	DIR dir;
+	FRESULT res;
+
+	Drives[ld].pd = pd;
+	Drives[ld].pt = pt;
+
+	fatfs[ld].fmap = fatfs_fmap[ld];
+	fatfs[ld].fmap_size = FAT_FMAP_WORDS;
+
+	res = f_mount(ld, &fatfs[ld]);
+	if (res == FR_OK && probe)
+		res = f_opendir(&dir, root);
+	if (res != FR_OK) {
+		umount_volume(ld);
+		return res;
+	}
+
+	mounted[ld] = 1;
+	return FR_OK;
+}
+
+static int is_fat_type(u8 type)
+{
+	switch (type) {
+	case 0x01: case 0x04: case 0x06:
+	case 0x0b: case 0x0c: case 0x0e:
+		return 1;
+	default:
+		return 0;
+	}
+}
 
 u32 fat_mount(void) {
 	DSTATUS stat;
 
-	f_mount(0, NULL);
+	fat_umount();
 
-	stat = disk_initialize(0);
+	stat = disk_initialize(DISK_SD);
 
 	if (stat & STA_NODISK)
 		return -1;
@@ -25,17 +85,148 @@ u32 fat_mount(void) {
 	if (stat & STA_NOINIT)
 		return -2;
 
-	return f_mount(0, &fatfs);
+	volumes = 1;
+	return mount_volume(0, DISK_SD, 0, 0);
+}
+
+// mount every FAT volume on every drive, SD first so it stays 0:
+u32 fat_mount_all(void) {
+	BYTE pd, pt;
+	u8 *e;
+
+	fat_umount();
+
+	for (pd = 0; pd < DISK_MAX && volumes < _DRIVES; pd++) {
+		if (disk_initialize(pd) & (STA_NODISK | STA_NOINIT))
+			continue;
+		if (disk_read(pd, mbr, 0, 1) != RES_OK)
+			continue;
+		if (mbr[510] != 0x55 || mbr[511] != 0xaa)
+			continue;
+
+		// a boot sector right at the start is a superfloppy
+		if (!memcmp(mbr + 54, "FAT", 3) || !memcmp(mbr + 82, "FAT", 3)) {
+			if (mount_volume(volumes, pd, 0, 1) == FR_OK) {
+				printf("fat: %u: is %s\n", volumes, disk_get(pd)->name);
+				volumes++;
+			}
+			continue;
+		}
+
+		for (pt = 0; pt < 4 && volumes < _DRIVES; pt++) {
+			e = mbr + 0x1be + pt * 16;
+			if (!is_fat_type(e[4]))
+				continue;
+			if (mount_volume(volumes, pd, pt, 1) == FR_OK) {
+				printf("fat: %u: is %s partition %u\n", volumes,
+					disk_get(pd)->name, pt);
+				volumes++;
+			}
+		}
+	}
+
+	return volumes;
+}
+
+// mount partition pt of drive pd as logical drive ld, unless ld is taken.
+// the volume is not probed, so a blank drive can be f_mkfs'd afterwards.
+s32 fat_mount_drive(BYTE ld, BYTE pd, BYTE pt) {
+	if (ld >= _DRIVES || mounted[ld])
+		return -1;
+
+	return mount_volume(ld, pd, pt, 0) == FR_OK ? 0 : -1;
+}
+
+// nonzero if logical drive ld is mounted
+int fat_drive_busy(BYTE ld) {
+	return ld >= _DRIVES || mounted[ld];
+}
+
+// nonzero if physical drive pd backs any mounted volume
+int fat_disk_busy(BYTE pd) {
+	BYTE ld;
+
+	for (ld = 0; ld < _DRIVES; ld++)
+		if (mounted[ld] && Drives[ld].pd == pd)
+			return 1;
+	return 0;
+}
+
+void fat_umount_drive(BYTE ld) {
+	if (ld < _DRIVES)
+		umount_volume(ld);
 }
 
 u32 fat_umount(void) {
-	f_mount(0, NULL);
+	BYTE ld;
+
+	for (ld = 0; ld < _DRIVES; ld++)
+		umount_volume(ld);
+	volumes = 0;
 
 	return 0;
 }
 
 u32 fat_clust2sect(u32 clust) {
-	return clust2sect(&fatfs, clust);
+	return clust2sect(&fatfs[0], clust);
 }
 
+// copy a file, e.g. "0:/a" to "1:/b", in large chunks straight between the
+// two volumes; the destination is preallocated so it streams contiguously
+s32 fat_copy(const char *from, const char *to) {
+	static FIL src, dst;
+	FRESULT res;
+	UINT br, bw;
+
+	res = f_open(&src, from, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK)
+		return res;
+
+	res = f_open(&dst, to, FA_WRITE | FA_CREATE_ALWAYS);
+	if (res != FR_OK) {
+		f_close(&src);
+		return res;
+	}
+
+	if (src.fsize) {
+		res = f_expand(&dst, src.fsize, 1);
+		// no contiguous run left is fine, the copy just fragments
+		if (res == FR_DENIED)
+			res = FR_OK;
+	}
+
+	while (res == FR_OK) {
+		res = f_read(&src, copy_buf, FAT_COPY_CHUNK, &br);
+		if (res != FR_OK || br == 0)
+			break;
+
+		res = f_write(&dst, copy_buf, br, &bw);
+		if (res == FR_OK && bw != br)
+			res = FR_DENIED;
+		if (res != FR_OK)
+			break;
+	}
+
+	f_close(&src);
+	if (res != FR_OK) {
+		fat_abort(&dst, to);
+		return res;
+	}
+	if (f_close(&dst) != FR_OK)
+		res = FR_DISK_ERR;
+
+	return res;
+}
+
+// close a file whose writing failed. f_expand made it full size up front,
+// so cut it at the last byte actually written, or delete it if even that
+// fails, rather than leave a garbage tail that looks complete.
+FRESULT fat_abort(FIL *fp, const char *path) {
+	if (f_lseek(fp, fp->fptr) == FR_OK && f_truncate(fp) == FR_OK &&
+	    f_close(fp) == FR_OK)
+		return FR_OK;
+
+	f_close(fp);
+	return f_unlink(path);
+}
 
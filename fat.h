@@ -15,8 +15,15 @@ Copyright (C) 2009		Andre Heider "dhewg" <dhewg@wiibrew.org>
 #include "diskio.h"
 
 u32 fat_mount(void);
+u32 fat_mount_all(void);
 u32 fat_umount(void);
+s32 fat_mount_drive(BYTE ld, BYTE pd, BYTE pt);
+void fat_umount_drive(BYTE ld);
+int fat_drive_busy(BYTE ld);
+int fat_disk_busy(BYTE pd);
 u32 fat_clust2sect(u32 clust);
+s32 fat_copy(const char *from, const char *to);
+FRESULT fat_abort(FIL *fp, const char *path);
 
 #endif
 
@@ -0,0 +1,252 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	FatFs throughput benchmark
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "fat.h"
+#include "fatbench.h"
+#include "ramdisk.h"
+#include "string.h"
+
+#define BENCH_CHUNK_MAX		(256 * 1024)
+#define BENCH_SEEKS			256
+#define BENCH_SEEK_SIZE		512
+#define BENCH_SMALL_FILES	64
+
+static u8 buf[BENCH_CHUNK_MAX] MEM2_BSS ALIGNED(64);
+
+static const u32 chunks[] = { 512, 4096, 32768, BENCH_CHUNK_MAX };
+
+static u32 kb_per_sec(u32 bytes, u32 us)
+{
+	if (us == 0)
+		return 0;
+	return (u64)bytes * 1000000 / 1024 / us;
+}
+
+static void report(const char *what, u32 arg, u32 bytes, u32 us)
+{
+	struct disk_stats st;
+
+	disk_get_stats(&st);
+	printf("bench: %-6s %6u: %6u ms", what, arg, us / 1000);
+	if (bytes)
+		printf(" %6u KB/s", kb_per_sec(bytes, us));
+	printf(", %u calls, %u sectors\n", st.calls, st.sectors);
+}
+
+static s32 seq_write(const char *path, u32 chunk)
+{
+	FIL fil;
+	UINT bw;
+	u32 done;
+	u64 start;
+
+	disk_reset_stats();
+	start = mftb();
+
+	if (f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return -1;
+
+	for (done = 0; done < FATBENCH_SIZE; done += chunk)
+		if (f_write(&fil, buf, chunk, &bw) != FR_OK || bw != chunk) {
+			f_close(&fil);
+			return -1;
+		}
+
+	if (f_close(&fil) != FR_OK)
+		return -1;
+
+	report("write", chunk, FATBENCH_SIZE, (mftb() - start) / TICKS_PER_USEC);
+	return 0;
+}
+
+static s32 seq_read(const char *path, u32 chunk)
+{
+	FIL fil;
+	UINT br;
+	u32 done;
+	u64 start;
+
+	disk_reset_stats();
+	start = mftb();
+
+	if (f_open(&fil, path, FA_READ) != FR_OK)
+		return -1;
+
+	for (done = 0; done < FATBENCH_SIZE; done += chunk)
+		if (f_read(&fil, buf, chunk, &br) != FR_OK || br != chunk) {
+			f_close(&fil);
+			return -1;
+		}
+
+	f_close(&fil);
+
+	report("read", chunk, FATBENCH_SIZE, (mftb() - start) / TICKS_PER_USEC);
+	return 0;
+}
+
+// fixed LCG so every run seeks to the same offsets
+static s32 random_seek(const char *path)
+{
+	FIL fil;
+	UINT br;
+	u32 i, seed = 1;
+	u64 start;
+
+	disk_reset_stats();
+	start = mftb();
+
+	if (f_open(&fil, path, FA_READ) != FR_OK)
+		return -1;
+
+	for (i = 0; i < BENCH_SEEKS; i++) {
+		seed = seed * 1103515245 + 12345;
+		if (f_lseek(&fil, (seed >> 8) % (FATBENCH_SIZE - BENCH_SEEK_SIZE)) != FR_OK ||
+				f_read(&fil, buf, BENCH_SEEK_SIZE, &br) != FR_OK ||
+				br != BENCH_SEEK_SIZE) {
+			f_close(&fil);
+			return -1;
+		}
+	}
+
+	f_close(&fil);
+
+	report("seek", BENCH_SEEKS, 0, (mftb() - start) / TICKS_PER_USEC);
+	return 0;
+}
+
+static s32 small_files(const char *vol)
+{
+	FIL fil;
+	UINT bw;
+	char path[32];
+	u32 i;
+	u64 start;
+
+	disk_reset_stats();
+	start = mftb();
+
+	for (i = 0; i < BENCH_SMALL_FILES; i++) {
+		sprintf(path, "%s/bench%03u.tmp", vol, i);
+		if (f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+			return -1;
+		if (f_write(&fil, buf, 1024, &bw) != FR_OK || bw != 1024) {
+			f_close(&fil);
+			return -1;
+		}
+		if (f_close(&fil) != FR_OK)
+			return -1;
+	}
+
+	report("create", BENCH_SMALL_FILES, 0, (mftb() - start) / TICKS_PER_USEC);
+
+	disk_reset_stats();
+	start = mftb();
+
+	for (i = 0; i < BENCH_SMALL_FILES; i++) {
+		sprintf(path, "%s/bench%03u.tmp", vol, i);
+		if (f_unlink(path) != FR_OK)
+			return -1;
+	}
+
+	report("delete", BENCH_SMALL_FILES, 0, (mftb() - start) / TICKS_PER_USEC);
+	return 0;
+}
+
+static s32 list_dir(const char *vol)
+{
+	DIR dir;
+	FILINFO fno;
+	u32 entries = 0;
+	u64 start;
+
+	disk_reset_stats();
+	start = mftb();
+
+	if (f_opendir(&dir, vol) != FR_OK)
+		return -1;
+
+	while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0])
+		entries++;
+
+	report("list", entries, 0, (mftb() - start) / TICKS_PER_USEC);
+	return 0;
+}
+
+s32 fat_bench(const char *vol)
+{
+	char path[32];
+	u32 i;
+	s32 res = 0;
+
+	sprintf(path, "%s/bench.tmp", vol);
+
+	for (i = 0; i < BENCH_CHUNK_MAX; i++)
+		buf[i] = i;
+
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]) && !res; i++) {
+		res = seq_write(path, chunks[i]);
+		if (!res)
+			res = seq_read(path, chunks[i]);
+	}
+
+	if (!res)
+		res = random_seek(path);
+
+	f_unlink(path);
+
+	if (!res)
+		res = small_files(vol);
+	if (!res)
+		res = list_dir(vol);
+
+	if (res)
+		printf("bench: %s failed\n", vol);
+
+	return res;
+}
+
+s32 fat_bench_ram(BYTE ld, void *mem, u32 sectors, u32 latency)
+{
+	char vol[4];
+	s32 res;
+
+	// check before ramdisk_init re-points a RAM disk that is still in use
+	if (fat_drive_busy(ld)) {
+		printf("bench: drive %u: is in use\n", ld);
+		return -1;
+	}
+	if (fat_disk_busy(DISK_RAM)) {
+		printf("bench: the RAM disk is already mounted\n");
+		return -1;
+	}
+
+	// set up like any other volume, free cluster bitmap included
+	if (ramdisk_init(mem, sectors) || fat_mount_drive(ld, DISK_RAM, 0))
+		return -1;
+
+	// the latency only applies to the benchmark, not to formatting
+	ramdisk_set_latency(0);
+	if (f_mkfs(ld, 1, 0) != FR_OK) {
+		printf("bench: can't format the RAM disk\n");
+		fat_umount_drive(ld);
+		return -1;
+	}
+
+	printf("bench: %u KB RAM disk, %u us per call\n", sectors / 2, latency);
+
+	ramdisk_set_latency(latency);
+	sprintf(vol, "%u:", ld);
+	res = fat_bench(vol);
+	ramdisk_set_latency(0);
+
+	fat_umount_drive(ld);
+	return res;
+}
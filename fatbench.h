@@ -0,0 +1,27 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	FatFs throughput benchmark
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __FATBENCH_H__
+#define __FATBENCH_H__
+
+#include "types.h"
+
+/* run the benchmark in the root of vol ("0:", "1:", ...); it leaves
+   nothing behind but needs FATBENCH_SIZE bytes free */
+#define FATBENCH_SIZE	(4 * 1024 * 1024)
+
+s32 fat_bench(const char *vol);
+
+/* format a RAM disk of the given size as logical drive ld and run the
+   benchmark on it, with each disk call stalled for latency microseconds */
+s32 fat_bench_ram(BYTE ld, void *mem, u32 sectors, u32 latency);
+
+#endif
+
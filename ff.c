@@ -201,6 +201,111 @@ void unlock_fs (
 
 
 
+#if _FS_WINCACHE
+/*-----------------------------------------------------------------------*/
+/* Sector cache behind the window                                        */
+/*-----------------------------------------------------------------------*/
+
+static
+BYTE wc_pool (		/* 0:FAT area, 1:anything else */
+	FATFS *fs,		/* File system object */
+	DWORD sect		/* Sector number */
+)
+{
+	return (sect >= fs->fatbase && sect < fs->fatbase + fs->sects_fat) ? 0 : 1;
+}
+
+
+static
+int wc_find (		/* Slot holding the sector, -1: not cached */
+	FATFS *fs,		/* File system object */
+	BYTE p,			/* Pool */
+	DWORD sect		/* Sector number */
+)
+{
+	int i;
+
+
+	for (i = 0; i < _FS_WINCACHE; i++)
+		if (fs->wc_sect[p][i] == sect) return i;
+
+	return -1;
+}
+
+
+#if !_FS_READONLY
+static
+BYTE wc_stage[_FS_WINCACHE * MAX_SS];	/* Gathers adjacent dirty sectors */
+
+static
+FRESULT wc_flush (	/* Write back the dirty sectors of a pool */
+	FATFS *fs,		/* File system object */
+	BYTE p			/* Pool */
+)
+{
+	DWORD sect;
+	UINT n;
+	int i, j, run[_FS_WINCACHE];
+	BYTE nf;
+
+
+	for (;;) {
+		for (i = -1, j = 0; j < _FS_WINCACHE; j++) {	/* Find the lowest dirty sector */
+			if (fs->wc_dirty[p][j] &&
+				(i < 0 || fs->wc_sect[p][j] < fs->wc_sect[p][i])) i = j;
+		}
+		if (i < 0) break;
+		sect = fs->wc_sect[p][i];
+		for (n = 0; i >= 0 && fs->wc_dirty[p][i]; n++) {	/* Gather the dirty run following it */
+			MemCpy(wc_stage + n * SS(fs), fs->wc_buf[p][i], SS(fs));
+			run[n] = i;
+			i = wc_find(fs, p, sect + n + 1);
+		}
+		if (disk_write(fs->drive, wc_stage, sect, n) != RES_OK)
+			return FR_DISK_ERR;		/* The run stays dirty for a retry */
+		for (j = 0; j < (int)n; j++) fs->wc_dirty[p][run[j]] = 0;
+		fs->wc_writes++;
+		fs->wc_wsects += n;
+		if (p == 0) {								/* In FAT area */
+			for (nf = fs->n_fats; nf >= 2; nf--) {	/* Refrect the change to FAT copy */
+				sect += fs->sects_fat;
+				disk_write(fs->drive, wc_stage, sect, n);
+			}
+		}
+	}
+
+	return FR_OK;
+}
+#endif
+
+
+static
+int wc_alloc (		/* Slot assigned to the sector, -1: disk error */
+	FATFS *fs,		/* File system object */
+	BYTE p,			/* Pool */
+	DWORD sect		/* Sector number */
+)
+{
+	int i, v = 0;
+
+
+	for (i = 0; i < _FS_WINCACHE; i++) {	/* Take an empty or the least recently used slot */
+		if (!fs->wc_sect[p][i]) { v = i; break; }
+		if (fs->wc_used[p][i] < fs->wc_used[p][v]) v = i;
+	}
+#if !_FS_READONLY
+	if (fs->wc_dirty[p][v] && wc_flush(fs, p) != FR_OK)
+		return -1;
+#endif
+	fs->wc_sect[p][v] = sect;
+
+	return v;
+}
+#endif /* _FS_WINCACHE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Change window offset                                                  */
 /*-----------------------------------------------------------------------*/
@@ -212,15 +317,27 @@ FRESULT move_window (
 )					/* Move to zero only writes back dirty window */
 {
 	DWORD wsect;
+#if _FS_WINCACHE
+	BYTE p;
+	int i;
+#endif
 
 
 	wsect = fs->winsect;
 	if (wsect != sector) {	/* Changed current window */
 #if !_FS_READONLY
 		if (fs->wflag) {	/* Write back dirty window if needed */
+#if _FS_WINCACHE
+			p = wc_pool(fs, wsect);			/* Keep it in the cache, the disk write is deferred */
+			i = wc_find(fs, p, wsect);
+			if (i < 0) i = wc_alloc(fs, p, wsect);
+			if (i < 0) return FR_DISK_ERR;
+			MemCpy(fs->wc_buf[p][i], fs->win, SS(fs));
+			fs->wc_dirty[p][i] = 1;
+			fs->wc_used[p][i] = ++fs->wc_clock;
+#else
 			if (disk_write(fs->drive, fs->win, wsect, 1) != RES_OK)
 				return FR_DISK_ERR;
-			fs->wflag = 0;
 			if (wsect < (fs->fatbase + fs->sects_fat)) {	/* In FAT area */
 				BYTE nf;
 				for (nf = fs->n_fats; nf >= 2; nf--) {	/* Refrect the change to FAT copy */
@@ -228,11 +345,31 @@ FRESULT move_window (
 					disk_write(fs->drive, fs->win, wsect, 1);
 				}
 			}
+#endif
+			fs->wflag = 0;
 		}
 #endif
 		if (sector) {
+#if _FS_WINCACHE
+			p = wc_pool(fs, sector);
+			i = wc_find(fs, p, sector);
+			if (i >= 0) {
+				fs->wc_hits++;
+			} else {
+				fs->wc_misses++;
+				i = wc_alloc(fs, p, sector);
+				if (i < 0) return FR_DISK_ERR;
+				if (disk_read(fs->drive, fs->wc_buf[p][i], sector, 1) != RES_OK) {
+					fs->wc_sect[p][i] = 0;
+					return FR_DISK_ERR;
+				}
+			}
+			fs->wc_used[p][i] = ++fs->wc_clock;
+			MemCpy(fs->win, fs->wc_buf[p][i], SS(fs));
+#else
 			if (disk_read(fs->drive, fs->win, sector, 1) != RES_OK)
 				return FR_DISK_ERR;
+#endif
 			fs->winsect = sector;
 		}
 	}
@@ -243,6 +380,74 @@ FRESULT move_window (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* File data transfer, kept coherent with the sector cache               */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT data_read (
+	FATFS *fs,		/* File system object */
+	BYTE *buff,		/* Data buffer */
+	DWORD sect,		/* First sector */
+	UINT count		/* Number of sectors */
+)
+{
+	DRESULT res;
+#if _FS_WINCACHE && !_FS_READONLY
+	BYTE p;
+	int i;
+#endif
+
+
+	res = disk_read(fs->drive, buff, sect, count);
+#if _FS_WINCACHE && !_FS_READONLY
+	for (p = 0; res == RES_OK && p < 2; p++) {	/* Cached data not yet on the disk wins */
+		for (i = 0; i < _FS_WINCACHE; i++) {
+			if (fs->wc_dirty[p][i] && fs->wc_sect[p][i] - sect < count)
+				MemCpy(buff + (fs->wc_sect[p][i] - sect) * SS(fs), fs->wc_buf[p][i], SS(fs));
+		}
+	}
+#endif
+
+	return res;
+}
+
+
+#if !_FS_READONLY
+static
+DRESULT data_write (
+	FATFS *fs,		/* File system object */
+	const BYTE *buff,	/* Data to be written */
+	DWORD sect,		/* First sector */
+	UINT count		/* Number of sectors */
+)
+{
+	DRESULT res;
+#if _FS_WINCACHE
+	BYTE p;
+	int i;
+#endif
+
+
+	res = disk_write(fs->drive, buff, sect, count);
+#if _FS_WINCACHE
+	for (p = 0; p < 2; p++) {					/* Cached copies are stale now */
+		for (i = 0; i < _FS_WINCACHE; i++) {
+			if (fs->wc_sect[p][i] - sect < count) {
+				fs->wc_sect[p][i] = 0;
+				fs->wc_dirty[p][i] = 0;
+			}
+		}
+	}
+#endif
+
+	return res;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Clean-up cached data                                                  */
 /*-----------------------------------------------------------------------*/
@@ -256,6 +461,10 @@ FRESULT sync (	/* FR_OK: successful, FR_DISK_ERR: failed */
 
 
 	res = move_window(fs, 0);
+#if _FS_WINCACHE
+	if (res == FR_OK) res = wc_flush(fs, 0);	/* FAT first, then the directories */
+	if (res == FR_OK) res = wc_flush(fs, 1);
+#endif
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag) {
@@ -323,6 +532,119 @@ DWORD get_cluster (	/* 0xFFFFFFFF:Disk error, 1:Interal error, Else:Cluster stat
 
 
 
+#if _FS_FREEMAP && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Free cluster bitmap                                                   */
+/*-----------------------------------------------------------------------*/
+
+#define	FMAP_SECTS	16		/* FAT sectors read at a time while building the bitmap */
+
+static
+BYTE fmap_scan[FMAP_SECTS * MAX_SS];
+
+
+static
+void fmap_mark (
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* Cluster# */
+	BYTE used		/* 1:in use, 0:free */
+)
+{
+	if (!fs->fmap_valid) return;
+	if (used)
+		fs->fmap[clst / 32] |= 1UL << (clst % 32);
+	else
+		fs->fmap[clst / 32] &= ~(1UL << (clst % 32));
+}
+
+
+static
+BYTE fmap_ready (	/* 1:bitmap can be used, 0:fall back to the FAT */
+	FATFS *fs		/* File system object */
+)
+{
+	DWORD clst, sect, val, nfree;
+	UINT n, i, ents;
+
+
+	if (fs->fmap_valid) return 1;
+	if (!fs->fmap || fs->fmap_size < (fs->max_clust + 31) / 32) return 0;
+
+	MemSet(fs->fmap, 0xFF, fs->fmap_size * 4);	/* Clusters 0, 1 and those past the end stay in use */
+	nfree = 0;
+	if (fs->fs_type == FS_FAT12) {
+		for (clst = 2; clst < fs->max_clust; clst++) {
+			val = get_cluster(fs, clst);
+			if (val == 0xFFFFFFFF || val == 1) return 0;
+			if (val == 0) {
+				fs->fmap[clst / 32] &= ~(1UL << (clst % 32));
+				nfree++;
+			}
+		}
+	} else {
+		if (move_window(fs, 0) != FR_OK) return 0;	/* Dirty FAT entries must be visible to data_read */
+		ents = SS(fs) / (fs->fs_type == FS_FAT16 ? 2 : 4);
+		sect = fs->fatbase;
+		clst = 0;
+		while (clst < fs->max_clust) {
+			n = FMAP_SECTS;
+			if (n > fs->fatbase + fs->sects_fat - sect) n = fs->fatbase + fs->sects_fat - sect;
+			if (!n || data_read(fs, fmap_scan, sect, n) != RES_OK) return 0;
+			for (i = 0; i < n * ents && clst < fs->max_clust; i++, clst++) {
+				if (fs->fs_type == FS_FAT16)
+					val = LD_WORD(fmap_scan + i * 2);
+				else
+					val = LD_DWORD(fmap_scan + i * 4) & 0x0FFFFFFF;
+				if (val == 0 && clst >= 2) {
+					fs->fmap[clst / 32] &= ~(1UL << (clst % 32));
+					nfree++;
+				}
+			}
+			sect += n;
+		}
+	}
+	fs->fmap_valid = 1;
+
+	if (fs->free_clust != nfree) {	/* The FSInfo count is only a hint, correct it */
+		fs->free_clust = nfree;
+		if (fs->fs_type == FS_FAT32) fs->fsi_flag = 1;
+	}
+
+	return 1;
+}
+
+
+static
+DWORD fmap_find (	/* Free cluster# following scl (wrapping around), 0: disk full */
+	FATFS *fs,		/* File system object */
+	DWORD scl		/* Search start point */
+)
+{
+	DWORD ncl, left, w, step;
+
+
+	ncl = scl + 1;
+	for (left = fs->max_clust; left; ) {
+		if (ncl >= fs->max_clust) ncl = 2;
+		w = fs->fmap[ncl / 32];
+		if (w == 0xFFFFFFFF) {			/* Skip a word without free clusters */
+			step = 32 - ncl % 32;
+			ncl += step;
+			left -= (step < left) ? step : left;
+			continue;
+		}
+		if (!(w & (1UL << (ncl % 32)))) return ncl;
+		ncl++;
+		left--;
+	}
+
+	return 0;
+}
+#endif /* _FS_FREEMAP */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Change a cluster status                                               */
 /*-----------------------------------------------------------------------*/
@@ -376,6 +698,9 @@ FRESULT put_cluster (
 			res = FR_INT_ERR;
 		}
 		fs->wflag = 1;
+#if _FS_FREEMAP
+		if (res == FR_OK) fmap_mark(fs, clst, val != 0);
+#endif
 	}
 
 	return res;
@@ -451,8 +776,13 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 		scl = clst;
 	}
 
-	ncl = scl;				/* Start cluster */
-	for (;;) {
+#if _FS_FREEMAP
+	if (fmap_ready(fs)) {	/* Take it from the bitmap */
+		ncl = fmap_find(fs, scl);
+		if (ncl == 0) return 0;			/* No free custer */
+	} else
+#endif
+	for (ncl = scl;;) {		/* Scan the FAT from the start cluster */
 		ncl++;							/* Next cluster */
 		if (ncl >= mcl) {				/* Wrap around */
 			ncl = 2;
@@ -518,6 +848,75 @@ DWORD f_check_contig(FIL *fp)
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Follow a run of physically consecutive clusters                       */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT follow_run (	/* Number of clusters the run was extended by */
+	FATFS *fs,		/* File system object */
+	DWORD *clst,	/* Cluster to start from, updated to the last one of the run */
+	UINT max,		/* Maximum number of clusters to extend by */
+	BOOL stretch	/* TRUE: allocate clusters past the end of the chain */
+)
+{
+	DWORD c = *clst, nxt;
+	UINT n;
+
+
+	for (n = 0; n < max; n++) {
+#if !_FS_READONLY
+		nxt = stretch ? create_chain(fs, c) : get_cluster(fs, c);
+#else
+		(void) stretch;
+		nxt = get_cluster(fs, c);
+#endif
+		if (nxt != c + 1) break;	/* End of run, end of chain or error */
+		c = nxt;
+	}
+	*clst = c;
+
+	return n;
+}
+
+
+
+
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Get cluster# from the cluster link map                                */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
+	FIL *fp,		/* Pointer to the file object */
+	DWORD ofs,		/* File offset to be converted to cluster# */
+	UINT *run		/* Number of clusters following it in the same fragment (null: not needed) */
+)
+{
+	DWORD cl, ncl, *tbl;
+
+
+	tbl = fp->cltbl + 1;						/* Top of the fragment list */
+	cl = ofs / SS(fp->fs) / fp->fs->csize;		/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;							/* Number of clusters in the fragment */
+		if (!ncl) {								/* End of table (error) */
+			if (run) *run = 0;
+			return 0;
+		}
+		if (cl < ncl) break;					/* In this fragment? */
+		cl -= ncl; tbl++;						/* Next fragment */
+	}
+	if (run) *run = (UINT)(ncl - cl - 1);
+
+	return cl + *tbl;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Seek directory index                                                  */
 /*-----------------------------------------------------------------------*/
@@ -790,6 +1189,41 @@ BYTE sum_sfn (
 /* Find an object in the directory                                       */
 /*-----------------------------------------------------------------------*/
 
+#if _FS_DIRCACHE
+static
+UINT dc_hash (		/* Cache slot for the name in the directory */
+	DWORD sclust,	/* Directory start cluster */
+	const BYTE *fn	/* SFN */
+)
+{
+	UINT i;
+	DWORD h = sclust;
+
+
+	for (i = 0; i < 11; i++) h = h * 31 + fn[i];
+
+	return (UINT)(h % _FS_DIRCACHE);
+}
+
+
+static
+void dc_drop (		/* Forget the cached entry at the directory index */
+	FATFS *fs,		/* File system object */
+	DWORD sclust,	/* Directory start cluster */
+	WORD index		/* Entry index */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DIRCACHE; i++) {
+		if (fs->dc_index[i] == index && fs->dc_sclust[i] == sclust)
+			fs->dc_index[i] = 0xFFFF;
+	}
+}
+#endif
+
+
 static
 FRESULT dir_find (
 	DIR *dj			/* Pointer to the directory object linked to the file name */
@@ -797,8 +1231,34 @@ FRESULT dir_find (
 {
 	FRESULT res;
 	BYTE a, c, stat, ord, sum, *dir;
+#if _FS_DIRCACHE
+	FATFS *fs = dj->fs;
+	UINT h = 0;
+#endif
 
 	ord = sum = 0xFF; stat = *(dj->fn+11);
+#if _FS_DIRCACHE
+	if (!(stat & 1)) {		/* Names matched by SFN can be cached */
+		h = dc_hash(dj->sclust, dj->fn);
+		if (dj->index == 0 && fs->dc_index[h] != 0xFFFF &&
+			fs->dc_sclust[h] == dj->sclust && !MemCmp(fs->dc_name[h], dj->fn, 11)) {
+			/* Go to the remembered entry and make sure it is still there */
+			if (dir_seek(dj, fs->dc_index[h]) == FR_OK &&
+				move_window(fs, dj->sect) == FR_OK &&
+				!MemCmp(dj->dir, dj->fn, 11) && !(dj->dir[DIR_Attr] & AM_VOL)) {
+#if _USE_LFN
+				dj->lfn_idx = fs->dc_lfn_idx[h];
+#endif
+				fs->dc_hits++;
+				return FR_OK;
+			}
+			fs->dc_index[h] = 0xFFFF;	/* Stale, scan from the top */
+			res = dir_seek(dj, 0);
+			if (res != FR_OK) return res;
+		}
+		fs->dc_misses++;
+	}
+#endif
 	do {
 		res = move_window(dj->fs, dj->sect);
 		if (res != FR_OK) break;
@@ -839,6 +1299,17 @@ FRESULT dir_find (
 		res = dir_next(dj, FALSE);				/* Next entry */
 	} while (res == FR_OK);
 
+#if _FS_DIRCACHE
+	if (res == FR_OK && !(stat & 1)) {	/* Remember where it was found */
+		fs->dc_sclust[h] = dj->sclust;
+		fs->dc_index[h] = dj->index;
+#if _USE_LFN
+		fs->dc_lfn_idx[h] = dj->lfn_idx;
+#endif
+		MemCpy(fs->dc_name[h], dj->fn, 11);
+	}
+#endif
+
 	return res;
 }
 
@@ -993,6 +1464,9 @@ FRESULT dir_register (	/* FR_OK:Successful, FR_DENIED:No free entry or too many
 			MemCpy(dir, dj->fn, 11);	/* Put SFN */
 			dir[DIR_NTres] = *(dj->fn+11) & 0x18;	/* Put NT flag */
 			dj->fs->wflag = 1;
+#if _FS_DIRCACHE
+			dc_drop(dj->fs, dj->sclust, dj->index);	/* The lookup cache learns it on the next dir_find */
+#endif
 		}
 	}
 
@@ -1041,6 +1515,9 @@ FRESULT dir_remove (	/* FR_OK: Successful, FR_DISK_ERR: A disk error */
 		}
 	}
 #endif
+#if _FS_DIRCACHE
+	dc_drop(dj->fs, dj->sclust, dj->index);	/* Forget the entry in the lookup cache */
+#endif
 
 	return res;
 }
@@ -1460,6 +1937,9 @@ FRESULT auto_mount (	/* FR_OK(0): successful, !=0: any error occured */
 	/* Initialize allocation information */
 	fs->free_clust = 0xFFFFFFFF;
 	fs->wflag = 0;
+#if _FS_FREEMAP
+	fs->fmap_valid = 0;
+#endif
 	/* Get fsinfo if needed */
 	if (fmt == FS_FAT32) {
 		fs->fsi_sector = bsect + LD_WORD(fs->win+BPB_FSInfo);
@@ -1474,6 +1954,13 @@ FRESULT auto_mount (	/* FR_OK(0): successful, !=0: any error occured */
 	}
 #endif
 	fs->winsect = 0;
+#if _FS_WINCACHE
+	MemSet(fs->wc_sect, 0, sizeof(fs->wc_sect));	/* Empty the sector cache */
+	MemSet(fs->wc_dirty, 0, sizeof(fs->wc_dirty));
+#endif
+#if _FS_DIRCACHE
+	MemSet(fs->dc_index, 0xFF, sizeof(fs->dc_index));	/* Empty the lookup cache */
+#endif
 	fs->fs_type = fmt;			/* FAT syb-type */
 	fs->id = ++Fsid;			/* File system mount ID */
 	res = FR_OK;
@@ -1644,6 +2131,9 @@ FRESULT f_open (
 	fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
 	fp->fptr = 0; fp->csect = 255;		/* File pointer */
 	fp->dsect = 0;
+#if _USE_FASTSEEK
+	fp->cltbl = 0;						/* No link map */
+#endif
 	fp->fs = dj.fs; fp->id = dj.fs->id;	/* Owner file system object of the file */
 
 	LEAVE_FF(dj.fs, FR_OK);
@@ -1665,7 +2155,10 @@ FRESULT f_read (
 {
 	FRESULT res;
 	DWORD clst, sect, remain;
-	UINT rcnt, cc;
+	UINT rcnt, cc, ncl;
+#if _USE_FASTSEEK
+	UINT run;
+#endif
 	BYTE *rbuff = buff;
 
 
@@ -1684,6 +2177,11 @@ FRESULT f_read (
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
 			if (fp->csect >= fp->fs->csize) {		/* On the cluster boundary? */
+#if _USE_FASTSEEK
+				if (fp->cltbl)						/* Take it from the link map */
+					clst = clmt_clust(fp, fp->fptr, NULL);
+				else
+#endif
 				clst = (fp->fptr == 0) ?			/* On the top of the file? */
 					fp->org_clust : get_cluster(fp->fs, fp->curr_clust);
 				if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
@@ -1696,24 +2194,40 @@ FRESULT f_read (
 			sect += fp->csect;
 			cc = btr / SS(fp->fs);					/* When remaining bytes >= sector size, */
 			if (cc) {								/* Read maximum contiguous sectors directly */
-				if (fp->csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - fp->csect;
-				if (disk_read(fp->fs->drive, rbuff, sect, (BYTE)cc) != RES_OK)
+				if (fp->csect + cc > fp->fs->csize) {	/* Crossing the cluster boundary? */
+					ncl = (fp->csect + cc) / fp->fs->csize - 1;	/* Extend over consecutive clusters */
+#if _USE_FASTSEEK
+					if (fp->cltbl) {				/* The link map knows the fragment length */
+						clmt_clust(fp, fp->fptr, &run);
+						if (ncl > run) ncl = run;
+						fp->curr_clust += ncl;
+					} else
+#endif
+					ncl = follow_run(fp->fs, &fp->curr_clust, ncl, FALSE);
+					cc = fp->fs->csize * (ncl + 1) - fp->csect;
+					fp->csect = fp->fs->csize;		/* Continue at the next cluster */
+				} else {
+					fp->csect += (BYTE)cc;			/* Next sector address in the cluster */
+				}
+				if (data_read(fp->fs, rbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
-				fp->csect += (BYTE)cc;				/* Next sector address in the cluster */
+#if !_FS_TINY && !_FS_READONLY
+				if ((fp->flag & FA__DIRTY) && fp->dsect - sect < cc)	/* Buffered sector is newer than the disk */
+					MemCpy(rbuff + (fp->dsect - sect) * SS(fp->fs), fp->buf, SS(fp->fs));
+#endif
 				rcnt = SS(fp->fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
 #if !_FS_TINY
 #if !_FS_READONLY
 			if (fp->flag & FA__DIRTY) {			/* Write sector I/O buffer if needed */
-				if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+				if (data_write(fp->fs, fp->buf, fp->dsect, 1) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 				fp->flag &= (BYTE)~FA__DIRTY;
 			}
 #endif
 			if (fp->dsect != sect) {			/* Fill sector buffer with file data */
-				if (disk_read(fp->fs->drive, fp->buf, sect, 1) != RES_OK)
+				if (data_read(fp->fs, fp->buf, sect, 1) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 			}
 #endif
@@ -1752,7 +2266,7 @@ FRESULT f_write (
 {
 	FRESULT res;
 	DWORD clst, sect;
-	UINT wcnt, cc;
+	UINT wcnt, cc, ncl;
 	const BYTE *wbuff = buff;
 
 
@@ -1788,7 +2302,7 @@ FRESULT f_write (
 				ABORT(fp->fs, FR_DISK_ERR);
 #else
 			if (fp->flag & FA__DIRTY) {		/* Write back data buffer prior to following direct transfer */
-				if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+				if (data_write(fp->fs, fp->buf, fp->dsect, 1) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 				fp->flag &= (BYTE)~FA__DIRTY;
 			}
@@ -1798,11 +2312,20 @@ FRESULT f_write (
 			sect += fp->csect;
 			cc = btw / SS(fp->fs);					/* When remaining bytes >= sector size, */
 			if (cc) {								/* Write maximum contiguous sectors directly */
-				if (fp->csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - fp->csect;
-				if (disk_write(fp->fs->drive, wbuff, sect, (BYTE)cc) != RES_OK)
+				if (fp->csect + cc > fp->fs->csize) {	/* Crossing the cluster boundary? */
+					ncl = (fp->csect + cc) / fp->fs->csize - 1;	/* Follow or stretch over consecutive clusters */
+					ncl = follow_run(fp->fs, &fp->curr_clust, ncl, TRUE);
+					cc = fp->fs->csize * (ncl + 1) - fp->csect;
+					fp->csect = fp->fs->csize;		/* Continue at the next cluster */
+				} else {
+					fp->csect += (BYTE)cc;			/* Next sector address in the cluster */
+				}
+				if (data_write(fp->fs, wbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
-				fp->csect += (BYTE)cc;				/* Next sector address in the cluster */
+#if !_FS_TINY
+				if (fp->dsect - sect < cc)			/* Refresh the buffered sector if it was overwritten */
+					MemCpy(fp->buf, wbuff + (fp->dsect - sect) * SS(fp->fs), SS(fp->fs));
+#endif
 				wcnt = SS(fp->fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
@@ -1814,7 +2337,7 @@ FRESULT f_write (
 #else
 			if (fp->dsect != sect) {				/* Fill sector buffer with file data */
 				if (fp->fptr < fp->fsize &&
-					disk_read(fp->fs->drive, fp->buf, sect, 1) != RES_OK)
+					data_read(fp->fs, fp->buf, sect, 1) != RES_OK)
 						ABORT(fp->fs, FR_DISK_ERR);
 			}
 #endif
@@ -1834,7 +2357,12 @@ FRESULT f_write (
 #endif
 	}
 
-	if (fp->fptr > fp->fsize) fp->fsize = fp->fptr;	/* Update file size if needed */
+	if (fp->fptr > fp->fsize) {						/* Update file size if needed */
+		fp->fsize = fp->fptr;
+#if _USE_FASTSEEK
+		fp->cltbl = 0;								/* The link map does not cover the new clusters */
+#endif
+	}
 	fp->flag |= FA__WRITTEN;						/* Set file changed flag */
 
 	LEAVE_FF(fp->fs, FR_OK);
@@ -1861,7 +2389,7 @@ FRESULT f_sync (
 		if (fp->flag & FA__WRITTEN) {	/* Has the file been written? */
 #if !_FS_TINY	/* Write-back dirty buffer */
 			if (fp->flag & FA__DIRTY) {
-				if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+				if (data_write(fp->fs, fp->buf, fp->dsect, 1) != RES_OK)
 					LEAVE_FF(fp->fs, FR_DISK_ERR);
 				fp->flag &= (BYTE)~FA__DIRTY;
 			}
@@ -1917,6 +2445,49 @@ FRESULT f_close (
 
 
 #if _FS_MINIMIZE <= 2
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Build the cluster link map of a file                                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT create_linkmap (
+	FIL *fp		/* Pointer to the file object, cltbl[0] holds the table size */
+)
+{
+	DWORD *tbl, tlen, ulen, cl, pcl, tcl, ncl;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++;						/* Given table size */
+	ulen = 2;							/* Required table size */
+	cl = fp->org_clust;
+	if (cl) {
+		do {
+			tcl = cl; ncl = 0;			/* Top of the fragment */
+			do {						/* Follow the fragment */
+				pcl = cl; ncl++;
+				cl = get_cluster(fp->fs, cl);
+				if (cl <= 1) return FR_INT_ERR;
+				if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			} while (cl == pcl + 1);
+			ulen += 2;
+			if (ulen <= tlen) {			/* Store (length, start cluster) */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fp->fs->max_clust);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;					/* Number of items used (or required) */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;
+	*tbl = 0;							/* Terminate the table */
+
+	return FR_OK;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Seek File R/W Pointer                                                 */
 /*-----------------------------------------------------------------------*/
@@ -1934,58 +2505,81 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->flag & FA__ERROR)			/* Check abort flag */
 		LEAVE_FF(fp->fs, FR_INT_ERR);
-	if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
-#if !_FS_READONLY
-		 && !(fp->flag & FA_WRITE)
-#endif
-		) ofs = fp->fsize;
-
-	ifptr = fp->fptr;
-	fp->fptr = 0; fp->csect = 255;
-	nsect = 0;
-	if (ofs > 0) {
-		bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
-		if (ifptr > 0 &&
-			(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
-			fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
-			ofs -= fp->fptr;
-			clst = fp->curr_clust;
-		} else {									/* When seek to back cluster, */
-			clst = fp->org_clust;					/* start from the first cluster */
-#if !_FS_READONLY
-			if (clst == 0) {						/* If no cluster chain, create a new chain */
-				clst = create_chain(fp->fs, 0);
-				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
-				fp->org_clust = clst;
-			}
-#endif
+#if _USE_FASTSEEK
+	if (fp->cltbl) {
+		if (ofs == CREATE_LINKMAP)		/* Build the link map */
+			LEAVE_FF(fp->fs, create_linkmap(fp));
+		if (ofs > fp->fsize) ofs = fp->fsize;	/* The map cannot stretch the file */
+		fp->fptr = ofs;
+		fp->csect = 255;
+		nsect = 0;
+		if (ofs > 0) {
+			clst = clmt_clust(fp, ofs - 1, NULL);	/* Cluster holding the last byte before ofs */
+			if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
 			fp->curr_clust = clst;
+			fp->csect = (BYTE)((ofs - 1) / SS(fp->fs) % fp->fs->csize) + 1;
+			if (ofs % SS(fp->fs)) {
+				nsect = clust2sect(fp->fs, clst);
+				if (!nsect) ABORT(fp->fs, FR_INT_ERR);
+				nsect += fp->csect - 1;
+			}
 		}
-		if (clst != 0) {
-			while (ofs > bcs) {						/* Cluster following loop */
+	} else
+#endif
+	{
+		if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
-				if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
-					clst = create_chain(fp->fs, clst);	/* Force streached if in write mode */
-					if (clst == 0) {				/* When disk gets full, clip file size */
-						ofs = bcs; break;
-					}
-				} else
+			 && !(fp->flag & FA_WRITE)
+#endif
+			) ofs = fp->fsize;
+
+		ifptr = fp->fptr;
+		fp->fptr = 0; fp->csect = 255;
+		nsect = 0;
+		if (ofs > 0) {
+			bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
+			if (ifptr > 0 &&
+				(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
+				fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
+				ofs -= fp->fptr;
+				clst = fp->curr_clust;
+			} else {									/* When seek to back cluster, */
+				clst = fp->org_clust;					/* start from the first cluster */
+#if !_FS_READONLY
+				if (clst == 0) {						/* If no cluster chain, create a new chain */
+					clst = create_chain(fp->fs, 0);
+					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
+					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+					fp->org_clust = clst;
+				}
 #endif
-					clst = get_cluster(fp->fs, clst);	/* Follow cluster chain if not in write mode */
-				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
-				if (clst <= 1 || clst >= fp->fs->max_clust) ABORT(fp->fs, FR_INT_ERR);
 				fp->curr_clust = clst;
-				fp->fptr += bcs;
-				ofs -= bcs;
 			}
-			fp->fptr += ofs;
-			fp->csect = (BYTE)(ofs / SS(fp->fs));	/* Sector offset in the cluster */
-			if (ofs % SS(fp->fs)) {
-				nsect = clust2sect(fp->fs, clst);	/* Current sector */
-				if (!nsect) ABORT(fp->fs, FR_INT_ERR);
-				nsect += fp->csect;
-				fp->csect++;
+			if (clst != 0) {
+				while (ofs > bcs) {						/* Cluster following loop */
+#if !_FS_READONLY
+					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
+						clst = create_chain(fp->fs, clst);	/* Force streached if in write mode */
+						if (clst == 0) {				/* When disk gets full, clip file size */
+							ofs = bcs; break;
+						}
+					} else
+#endif
+						clst = get_cluster(fp->fs, clst);	/* Follow cluster chain if not in write mode */
+					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+					if (clst <= 1 || clst >= fp->fs->max_clust) ABORT(fp->fs, FR_INT_ERR);
+					fp->curr_clust = clst;
+					fp->fptr += bcs;
+					ofs -= bcs;
+				}
+				fp->fptr += ofs;
+				fp->csect = (BYTE)(ofs / SS(fp->fs));	/* Sector offset in the cluster */
+				if (ofs % SS(fp->fs)) {
+					nsect = clust2sect(fp->fs, clst);	/* Current sector */
+					if (!nsect) ABORT(fp->fs, FR_INT_ERR);
+					nsect += fp->csect;
+					fp->csect++;
+				}
 			}
 		}
 	}
@@ -1993,12 +2587,12 @@ FRESULT f_lseek (
 #if !_FS_TINY
 #if !_FS_READONLY
 		if (fp->flag & FA__DIRTY) {			/* Write-back dirty buffer if needed */
-			if (disk_write(fp->fs->drive, fp->buf, fp->dsect, 1) != RES_OK)
+			if (data_write(fp->fs, fp->buf, fp->dsect, 1) != RES_OK)
 				ABORT(fp->fs, FR_DISK_ERR);
 			fp->flag &= (BYTE)~FA__DIRTY;
 		}
 #endif
-		if (disk_read(fp->fs->drive, fp->buf, nsect, 1) != RES_OK)
+		if (data_read(fp->fs, fp->buf, nsect, 1) != RES_OK)
 			ABORT(fp->fs, FR_DISK_ERR);
 #endif
 		fp->dsect = nsect;
@@ -2176,6 +2770,89 @@ FRESULT f_truncate (
 
 
 
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Area to the File                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_expand (
+	FIL *fp,		/* Pointer to the file object */
+	DWORD fsz,		/* File size to be expanded to */
+	BYTE opt		/* 1:allocate now, 0:only make it the next allocation point */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, stcl, scl, ncl, cs, bcs;
+	BYTE wrap;
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (!(fp->flag & FA_WRITE) || fp->fsize != 0 || fp->org_clust != 0 || fsz == 0)
+		LEAVE_FF(fp->fs, FR_DENIED);	/* Only an empty file can be expanded */
+
+	fs = fp->fs;
+	bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size (byte) */
+	n = (fsz + bcs - 1) / bcs;			/* Number of clusters required */
+	if (n > fs->max_clust - 2) LEAVE_FF(fs, FR_DENIED);
+
+	/* Find a run of n free clusters, starting at the last allocation point */
+	stcl = fs->last_clust;
+	if (stcl < 2 || stcl >= fs->max_clust) stcl = 2;
+	scl = clst = stcl; ncl = 0; wrap = 0;
+	for (;;) {
+#if _FS_FREEMAP
+		if (fmap_ready(fs))
+			cs = (fs->fmap[clst / 32] >> (clst % 32)) & 1;
+		else
+#endif
+		cs = get_cluster(fs, clst);
+		if (cs == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+		if (cs == 0) {					/* A free cluster extends the run */
+			if (++ncl == n) break;
+		} else {						/* A used one restarts it */
+			scl = clst + 1; ncl = 0;
+		}
+		if (++clst >= fs->max_clust) {	/* Wrap around, a run cannot span the end */
+			if (wrap) LEAVE_FF(fs, FR_DENIED);
+			scl = clst = 2; ncl = 0; wrap = 1;
+		}
+		/* After the wrap a run may still grow across stcl, but one that
+		   starts at or above it has already been tried */
+		if (wrap && scl >= stcl) LEAVE_FF(fs, FR_DENIED);	/* No contiguous area large enough */
+	}
+
+	if (opt) {
+		/* Link the run in one go, the FAT sectors stay in the window cache until the sync */
+		for (clst = scl; clst < scl + n - 1 && res == FR_OK; clst++)
+			res = put_cluster(fs, clst, clst + 1);
+		if (res == FR_OK) res = put_cluster(fs, clst, 0x0FFFFFFF);
+		if (res != FR_OK) {
+			fp->flag |= FA__ERROR;
+			LEAVE_FF(fs, res);
+		}
+		if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSInfo */
+			fs->free_clust -= n;
+			fs->fsi_flag = 1;
+		}
+		fs->last_clust = clst;
+		fp->org_clust = scl;			/* The file now owns the run */
+		fp->fsize = fsz;
+		fp->flag |= FA__WRITTEN;
+	} else {
+		fs->last_clust = scl - 1;		/* The next allocation starts at the run */
+	}
+
+	LEAVE_FF(fs, FR_OK);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get Number of Free Clusters                                           */
 /*-----------------------------------------------------------------------*/
@@ -2201,6 +2878,14 @@ FRESULT f_getfree (
 		LEAVE_FF(*fatfs, FR_OK);
 	}
 
+#if _FS_FREEMAP
+	/* Building the bitmap counts them as well */
+	if (fmap_ready(*fatfs)) {
+		*nclst = (*fatfs)->free_clust;
+		LEAVE_FF(*fatfs, FR_OK);
+	}
+#endif
+
 	/* Get number of free clusters */
 	fat = (*fatfs)->fs_type;
 	n = 0;
@@ -61,7 +61,7 @@
 /  data transfer. This reduces memory consumption 512 bytes each file object. */
 
 
-#define _DRIVES		1
+#define _DRIVES		4
 /* Number of volumes (logical drives) to be used. */
 
 
@@ -77,6 +77,42 @@
 /* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_FS_WINCACHE	8
+/* Number of sectors cached behind win[], for the FAT and the directory area
+/  each. A sector that leaves the window stays in the cache, dirty ones are
+/  written back lazily (adjacent ones in a single disk_write) when the cache
+/  needs the room or the file system is synced. Each FATFS object grows by
+/  about 2 * _FS_WINCACHE sectors. Set to 0 to disable the cache. */
+
+
+#define	_FS_FREEMAP	1
+/* To keep a bitmap of the free clusters in memory, set _FS_FREEMAP to 1 and
+/  point FATFS.fmap at a DWORD array of FATFS.fmap_size items (one bit per
+/  cluster) before mounting. It is built from the FAT on first use, after
+/  which cluster allocation and f_getfree need no FAT scan. A volume with
+/  more clusters than the bitmap holds falls back to scanning the FAT. */
+
+
+#define	_USE_EXPAND	1
+/* To enable f_expand function, set _USE_EXPAND to 1 and set _FS_READONLY
+/  to 0. It gives an empty file a contiguous cluster chain in one go. */
+
+
+#define	_FS_DIRCACHE	64
+/* Number of entries in the per-volume directory lookup cache. dir_find
+/  remembers where it found a name (by directory start cluster and SFN) and
+/  goes straight back there on the next lookup, checking the entry before
+/  trusting it. Names that only match by LFN are not cached. Set to 0 to
+/  disable the cache. */
+
+
+#define	_USE_FASTSEEK	1
+/* To enable the cluster link map (fast seek) feature, set _USE_FASTSEEK to 1.
+/  Point FIL.cltbl at a DWORD array whose first item holds its length and call
+/  f_lseek(fp, CREATE_LINKMAP). Seeks and reads on the file then take their
+/  clusters from the map instead of the FAT. */
+
+
 #define	_USE_LFN	0
 #define	_MAX_LFN	255		/* Maximum LFN length to handle (max:255) */
 /* The _USE_LFN option switches the LFN support.
@@ -113,10 +149,11 @@
 */
 
 
-#define	_MULTI_PARTITION	0
+#define	_MULTI_PARTITION	1
 /* When _MULTI_PARTITION is set to 0, each volume is bound to same physical
 / drive number and can mount only 1st primaly partition. When it is set to 1,
-/ each volume is tied to the partition listed in Drives[]. */
+/ each volume is tied to the partition listed in Drives[], which fat.c fills
+/ in as it finds volumes. */
 
 
 #define _FS_REENTRANT	0
@@ -170,6 +207,11 @@ typedef struct _FATFS {
 	DWORD	last_clust;	/* Last allocated cluster */
 	DWORD	free_clust;	/* Number of free clusters */
 	DWORD	fsi_sector;	/* fsinfo sector */
+#if _FS_FREEMAP
+	DWORD*	fmap;		/* Free cluster bitmap, 1:in use (set by the user) */
+	DWORD	fmap_size;	/* Size of the bitmap in DWORDs (set by the user) */
+	BYTE	fmap_valid;	/* Bitmap matches the FAT */
+#endif
 #endif
 	DWORD	sects_fat;	/* Sectors per fat */
 	DWORD	max_clust;	/* Maximum cluster# + 1. Number of clusters is max_clust - 2 */
@@ -178,6 +220,27 @@ typedef struct _FATFS {
 	DWORD	database;	/* Data start sector */
 	DWORD	winsect;	/* Current sector appearing in the win[] */
 	BYTE	win[MAX_SS];/* Disk access window for Directory/FAT */
+#if _FS_WINCACHE
+	DWORD	wc_sect[2][_FS_WINCACHE];	/* Cached sector# (0:empty), [0]:FAT [1]:directory */
+	DWORD	wc_used[2][_FS_WINCACHE];	/* Last use stamp */
+	BYTE	wc_dirty[2][_FS_WINCACHE];	/* Dirty flags (1:must be written back) */
+	DWORD	wc_clock;	/* Use stamp counter */
+	DWORD	wc_hits;	/* Sectors found in the cache */
+	DWORD	wc_misses;	/* Sectors read from the disk */
+	DWORD	wc_writes;	/* disk_write calls issued by the write back */
+	DWORD	wc_wsects;	/* Sectors written back */
+	BYTE	wc_buf[2][_FS_WINCACHE][MAX_SS];	/* Cached sector data */
+#endif
+#if _FS_DIRCACHE
+	DWORD	dc_sclust[_FS_DIRCACHE];	/* Directory start cluster */
+	WORD	dc_index[_FS_DIRCACHE];		/* Entry index in the directory (0xFFFF:empty) */
+#if _USE_LFN
+	WORD	dc_lfn_idx[_FS_DIRCACHE];	/* Index of its LFN entries */
+#endif
+	BYTE	dc_name[_FS_DIRCACHE][11];	/* SFN of the entry */
+	DWORD	dc_hits;	/* Lookups served from the cache */
+	DWORD	dc_misses;	/* Lookups that scanned the directory */
+#endif
 } FATFS;
 
 
@@ -213,6 +276,9 @@ typedef struct _FIL {
 	DWORD	org_clust;	/* File start cluster */
 	DWORD	curr_clust;	/* Current cluster */
 	DWORD	dsect;		/* Current data sector */
+#if _USE_FASTSEEK
+	DWORD*	cltbl;		/* Pointer to the cluster link map table (null on file open) */
+#endif
 #if _FS_READONLY == 0
 	DWORD	dir_sect;	/* Sector containing the directory entry */
 	BYTE*	dir_ptr;	/* Ponter to the directory entry in the window */
@@ -324,7 +390,7 @@ typedef struct _PARTITION {
 } PARTITION;
 
 extern
-const PARTITION Drives[];			/* Logical drive# to physical location conversion table */
+PARTITION Drives[];					/* Logical drive# to physical location conversion table */
 #define LD2PD(drv) (Drives[drv].pd)	/* Get physical drive# */
 #define LD2PT(drv) (Drives[drv].pt)	/* Get partition# */
 
@@ -355,7 +421,8 @@ typedef enum {
 	FR_NOT_ENABLED,		/* 12 */
 	FR_NO_FILESYSTEM,	/* 13 */
 	FR_MKFS_ABORTED,	/* 14 */
-	FR_TIMEOUT			/* 15 */
+	FR_TIMEOUT,			/* 15 */
+	FR_NOT_ENOUGH_CORE	/* 16 */
 } FRESULT;
 
 
@@ -374,6 +441,7 @@ FRESULT f_readdir (DIR*, FILINFO*);					/* Read a directory item */
 FRESULT f_stat (const char*, FILINFO*);				/* Get file status */
 FRESULT f_getfree (const char*, DWORD*, FATFS**);	/* Get number of free clusters on the drive */
 FRESULT f_truncate (FIL*);							/* Truncate file */
+FRESULT f_expand (FIL*, DWORD, BYTE);				/* Allocate a contiguous area to the file */
 FRESULT f_sync (FIL*);								/* Flush cached data of a writing file */
 FRESULT f_unlink (const char*);						/* Delete an existing file or directory */
 FRESULT	f_mkdir (const char*);						/* Create a new directory */
@@ -418,6 +486,11 @@ DWORD f_check_contig(FIL *fp);
 /* Flags and offset address                                     */
 
 
+/* f_lseek() offset to build the cluster link map (_USE_FASTSEEK) */
+
+#define	CREATE_LINKMAP	0xFFFFFFFF
+
+
 /* File access control and file status flags (FIL.flag) */
 
 #define	FA_READ				0x01
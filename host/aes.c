@@ -0,0 +1,178 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: software AES-128-CBC in place of mini's AES engine
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "aes.h"
+#include "string.h"
+
+static u8 sbox[256], rsbox[256];
+static int tables_ready;
+
+static u8 rotl8(u8 x, int n)
+{
+	return (x << n) | (x >> (8 - n));
+}
+
+static u8 xtime(u8 x)
+{
+	return (x << 1) ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static u8 gmul(u8 a, u8 b)
+{
+	u8 p = 0;
+
+	while (b) {
+		if (b & 1)
+			p ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return p;
+}
+
+// walk GF(2^8) with generator 3 and its inverse to get the S-box
+// without a hand typed table
+static void build_tables(void)
+{
+	u8 p = 1, q = 1, x;
+	int i;
+
+	do {
+		p = p ^ xtime(p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80)
+			q ^= 0x09;
+		x = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4);
+		sbox[p] = x ^ 0x63;
+	} while (p != 1);
+	sbox[0] = 0x63;
+
+	for (i = 0; i < 256; i++)
+		rsbox[sbox[i]] = i;
+
+	tables_ready = 1;
+}
+
+void aes128_set_key(struct aes128 *ctx, const u8 *key)
+{
+	u8 *w = &ctx->rk[0][0];
+	u8 t[4], rcon = 1, tmp;
+	int i;
+
+	if (!tables_ready)
+		build_tables();
+
+	memcpy(w, key, 16);
+	for (i = 16; i < 176; i += 4) {
+		memcpy(t, w + i - 4, 4);
+		if (i % 16 == 0) {
+			tmp = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[tmp];
+			rcon = xtime(rcon);
+		}
+		w[i + 0] = w[i - 16] ^ t[0];
+		w[i + 1] = w[i - 15] ^ t[1];
+		w[i + 2] = w[i - 14] ^ t[2];
+		w[i + 3] = w[i - 13] ^ t[3];
+	}
+}
+
+static void add_round_key(u8 *s, const u8 *rk)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+// the state is column major: s[row + 4*col]
+static void encrypt_block(const struct aes128 *ctx, u8 *s)
+{
+	u8 t[16], a0, a1, a2, a3;
+	int round, r, c;
+
+	add_round_key(s, ctx->rk[0]);
+	for (round = 1; round <= 10; round++) {
+		for (r = 0; r < 4; r++)
+			for (c = 0; c < 4; c++)
+				t[r + 4*c] = sbox[s[r + 4*((c + r) & 3)]];
+
+		if (round < 10) {
+			for (c = 0; c < 4; c++) {
+				a0 = t[4*c]; a1 = t[4*c + 1];
+				a2 = t[4*c + 2]; a3 = t[4*c + 3];
+				s[4*c + 0] = xtime(a0) ^ xtime(a1) ^ a1 ^ a2 ^ a3;
+				s[4*c + 1] = a0 ^ xtime(a1) ^ xtime(a2) ^ a2 ^ a3;
+				s[4*c + 2] = a0 ^ a1 ^ xtime(a2) ^ xtime(a3) ^ a3;
+				s[4*c + 3] = xtime(a0) ^ a0 ^ a1 ^ a2 ^ xtime(a3);
+			}
+		} else
+			memcpy(s, t, 16);
+
+		add_round_key(s, ctx->rk[round]);
+	}
+}
+
+static void decrypt_block(const struct aes128 *ctx, u8 *s)
+{
+	u8 t[16], a0, a1, a2, a3;
+	int round, r, c;
+
+	add_round_key(s, ctx->rk[10]);
+	for (round = 9; round >= 0; round--) {
+		for (r = 0; r < 4; r++)
+			for (c = 0; c < 4; c++)
+				t[r + 4*((c + r) & 3)] = rsbox[s[r + 4*c]];
+
+		add_round_key(t, ctx->rk[round]);
+
+		if (round > 0) {
+			for (c = 0; c < 4; c++) {
+				a0 = t[4*c]; a1 = t[4*c + 1];
+				a2 = t[4*c + 2]; a3 = t[4*c + 3];
+				s[4*c + 0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+				s[4*c + 1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+				s[4*c + 2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+				s[4*c + 3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+			}
+		} else
+			memcpy(s, t, 16);
+	}
+}
+
+void aes128_cbc_encrypt(const struct aes128 *ctx, u8 *iv, u8 *buf, u32 len)
+{
+	int i;
+
+	for (; len >= 16; len -= 16, buf += 16) {
+		for (i = 0; i < 16; i++)
+			buf[i] ^= iv[i];
+		encrypt_block(ctx, buf);
+		memcpy(iv, buf, 16);
+	}
+}
+
+void aes128_cbc_decrypt(const struct aes128 *ctx, u8 *iv, u8 *buf, u32 len)
+{
+	u8 next[16];
+	int i;
+
+	for (; len >= 16; len -= 16, buf += 16) {
+		memcpy(next, buf, 16);
+		decrypt_block(ctx, buf);
+		for (i = 0; i < 16; i++)
+			buf[i] ^= iv[i];
+		memcpy(iv, next, 16);
+	}
+}
@@ -0,0 +1,25 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: software AES-128-CBC in place of mini's AES engine
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __AES_H__
+#define __AES_H__
+
+#include "types.h"
+
+struct aes128 {
+	u8 rk[11][16];
+};
+
+void aes128_set_key(struct aes128 *ctx, const u8 *key);
+
+/* len is a multiple of 16; iv is updated so calls can be chained */
+void aes128_cbc_encrypt(const struct aes128 *ctx, u8 *iv, u8 *buf, u32 len);
+void aes128_cbc_decrypt(const struct aes128 *ctx, u8 *iv, u8 *buf, u32 len);
+
+#endif
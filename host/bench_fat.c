@@ -0,0 +1,76 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: the FatFs benchmark on an SD image and a RAM disk
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "fat.h"
+#include "fatbench.h"
+#include "string.h"
+#include "hostio.h"
+#include "mini.h"
+
+#define IMAGE		"fatbench.img"
+#define SD_SECTORS	(64 * 1024 * 2)
+#define RAM_SECTORS	(16 * 1024 * 2)
+
+static u8 ram[RAM_SECTORS * 512] ALIGNED(64);
+
+// the SD path through diskio.c: bounce buffer, read-ahead, write-behind
+static s32 bench_sd(u32 latency)
+{
+	s32 res;
+
+	if (mini_sd_open(IMAGE, SD_SECTORS))
+		return -1;
+
+	if (fat_mount_drive(0, DISK_SD, 0)) {
+		mini_sd_close();
+		return -1;
+	}
+
+	if (f_mkfs(0, 1, 0) != FR_OK) {
+		printf("bench: can't format " IMAGE "\n");
+		fat_umount_drive(0);
+		mini_sd_close();
+		return -1;
+	}
+
+	printf("bench: %u KB SD image, %u us per request\n",
+		SD_SECTORS / 2, latency);
+
+	mini_set_latency(latency);
+	res = fat_bench("0:");
+	mini_set_latency(0);
+
+	fat_umount_drive(0);
+	mini_sd_close();
+	return res;
+}
+
+static u32 parse_u32(const char *s)
+{
+	u32 v = 0;
+
+	while (*s >= '0' && *s <= '9')
+		v = v * 10 + *s++ - '0';
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	u32 latency = argc > 1 ? parse_u32(argv[1]) : 0;
+	s32 res;
+
+	res = bench_sd(latency);
+	hostio_unlink(IMAGE);
+
+	if (!res)
+		res = fat_bench_ram(1, ram, RAM_SECTORS, latency);
+
+	return res ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: the parts of bootmii_ppc.h that touch the hardware
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "hostio.h"
+
+// a timebase running at the console's rate, so TICKS_PER_USEC still holds
+u64 mftb(void)
+{
+	return hostio_usec() * TICKS_PER_USEC;
+}
+
+void udelay(u32 us)
+{
+	u64 end = hostio_usec() + us;
+
+	while (hostio_usec() < end)
+		;
+}
+
+// there is no DMA on the host, all memory is coherent
+void sync_before_read(void *p, u32 len)
+{
+	(void)p;
+	(void)len;
+}
+
+void sync_after_write(const void *p, u32 len)
+{
+	(void)p;
+	(void)len;
+}
+
+void sync_before_exec(const void *p, u32 len)
+{
+	(void)p;
+	(void)len;
+}
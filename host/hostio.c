@@ -0,0 +1,68 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: file and clock access
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hostio.h"
+
+int hostio_open(const char *path, int mode)
+{
+	if (mode == HOSTIO_CREATE)
+		return open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (mode == HOSTIO_WRITE)
+		return open(path, O_RDWR);
+	return open(path, O_RDONLY);
+}
+
+void hostio_close(int fd)
+{
+	close(fd);
+}
+
+int hostio_unlink(const char *path)
+{
+	return unlink(path);
+}
+
+int hostio_pread(int fd, void *buf, unsigned int len, unsigned long long off)
+{
+	return pread(fd, buf, len, off) == (ssize_t)len ? 0 : -1;
+}
+
+int hostio_pwrite(int fd, const void *buf, unsigned int len,
+		unsigned long long off)
+{
+	return pwrite(fd, buf, len, off) == (ssize_t)len ? 0 : -1;
+}
+
+unsigned long long hostio_size(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return 0;
+	return st.st_size;
+}
+
+int hostio_truncate(int fd, unsigned long long size)
+{
+	return ftruncate(fd, size);
+}
+
+unsigned long long hostio_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,36 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: file and clock access
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __HOSTIO_H__
+#define __HOSTIO_H__
+
+/* hostio.c is the only host file built against the C library; everything
+   else sees the console's types.h and string.h. so this interface sticks
+   to plain C types. */
+
+#define HOSTIO_READ	0	/* existing file, read only */
+#define HOSTIO_CREATE	1	/* new empty file, read/write */
+#define HOSTIO_WRITE	2	/* existing file, read/write */
+
+int hostio_open(const char *path, int mode);
+void hostio_close(int fd);
+int hostio_unlink(const char *path);
+
+/* both return 0 if all len bytes were transferred */
+int hostio_pread(int fd, void *buf, unsigned int len, unsigned long long off);
+int hostio_pwrite(int fd, const void *buf, unsigned int len,
+		unsigned long long off);
+
+unsigned long long hostio_size(int fd);
+int hostio_truncate(int fd, unsigned long long size);
+
+/* monotonic clock in microseconds */
+unsigned long long hostio_usec(void);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: mini's side of the IPC calls, served from image files
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "mini_ipc.h"
+#include "string.h"
+#include "hostio.h"
+#include "mini.h"
+
+#define NAND_DATA	0x800
+#define NAND_SPARE	0x40
+#define NAND_RAW	(NAND_DATA + NAND_SPARE)
+#define NAND_BLOCK	64
+#define NAND_BLOCKS	(0x40000 / NAND_BLOCK)
+
+static int sd_fd = -1;
+static u32 sd_sectors;
+static int nand_fd = -1;
+static u32 nand_pages;
+static u8 nand_worn[NAND_BLOCKS];
+static u32 latency;
+
+s32 mini_sd_open(const char *path, u32 sectors)
+{
+	mini_sd_close();
+
+	sd_fd = hostio_open(path, sectors ? HOSTIO_CREATE : HOSTIO_WRITE);
+	if (sd_fd < 0) {
+		printf("mini: can't open %s\n", path);
+		return -1;
+	}
+
+	if (sectors && hostio_truncate(sd_fd, (u64)sectors * 512)) {
+		printf("mini: can't size %s\n", path);
+		mini_sd_close();
+		return -1;
+	}
+
+	sd_sectors = hostio_size(sd_fd) / 512;
+	return 0;
+}
+
+void mini_sd_close(void)
+{
+	if (sd_fd >= 0)
+		hostio_close(sd_fd);
+	sd_fd = -1;
+	sd_sectors = 0;
+}
+
+s32 mini_nand_open(const char *path)
+{
+	mini_nand_close();
+
+	nand_fd = hostio_open(path, HOSTIO_WRITE);
+	if (nand_fd < 0) {
+		printf("mini: can't open %s\n", path);
+		return -1;
+	}
+
+	nand_pages = hostio_size(nand_fd) / NAND_RAW;
+	memset(nand_worn, 0, sizeof(nand_worn));
+	return 0;
+}
+
+void mini_nand_close(void)
+{
+	if (nand_fd >= 0)
+		hostio_close(nand_fd);
+	nand_fd = -1;
+	nand_pages = 0;
+}
+
+void mini_nand_wear_out(u32 block)
+{
+	if (block < NAND_BLOCKS)
+		nand_worn[block] = 1;
+}
+
+void mini_set_latency(u32 us)
+{
+	latency = us;
+}
+
+// a 64 bit host pointer doesn't fit into one argument
+static void put_ptr(ipc_request *req, int arg, const void *p)
+{
+	u64 v = (unsigned long)p;
+
+	req->args[arg] = v;
+	req->args[arg + 1] = v >> 32;
+}
+
+static void *get_ptr(const ipc_request *req, int arg)
+{
+	return (void *)(unsigned long)(req->args[arg] |
+		(u64)req->args[arg + 1] << 32);
+}
+
+static int sd_io(u32 start, u32 count, void *buf, int write)
+{
+	u64 ofs = (u64)start * 512;
+
+	if (sd_fd < 0)
+		return SDHC_ENOCARD;
+	if (start >= sd_sectors || count > sd_sectors - start)
+		return SDHC_EINVAL;
+
+	if (latency)
+		udelay(latency);
+
+	if (write ? hostio_pwrite(sd_fd, buf, count * 512, ofs) :
+			hostio_pread(sd_fd, buf, count * 512, ofs))
+		return SDHC_EIO;
+	return 0;
+}
+
+static int nand_page_io(u32 page, u8 *raw, int write)
+{
+	if (nand_fd < 0 || page >= nand_pages)
+		return -1;
+
+	if (latency)
+		udelay(latency);
+
+	if (write)
+		return hostio_pwrite(nand_fd, raw, NAND_RAW, (u64)page * NAND_RAW);
+	return hostio_pread(nand_fd, raw, NAND_RAW, (u64)page * NAND_RAW);
+}
+
+// data and spare may each be NULL; the status is NAND_ECC_OK or -1
+static int nand_read_page(u32 page, u8 *data, u8 *spare)
+{
+	u8 raw[NAND_RAW];
+
+	if (nand_page_io(page, raw, 0))
+		return -1;
+
+	if (data)
+		memcpy(data, raw, NAND_DATA);
+	if (spare)
+		memcpy(spare, raw + NAND_DATA, NAND_SPARE);
+	return NAND_ECC_OK;
+}
+
+// programming can only turn ones into zeroes
+static int nand_program_page(u32 page, const u8 *data, const u8 *spare)
+{
+	u8 raw[NAND_RAW];
+	u32 i;
+
+	if (nand_page_io(page, raw, 0))
+		return -1;
+	if (nand_worn[page / NAND_BLOCK])
+		return 0;
+
+	for (i = 0; data && i < NAND_DATA; i++)
+		raw[i] &= data[i];
+	for (i = 0; spare && i < NAND_SPARE; i++)
+		raw[NAND_DATA + i] &= spare[i];
+
+	return nand_page_io(page, raw, 1);
+}
+
+// what mini would do with one request; the status goes to args[0]
+static void serve(ipc_request *req)
+{
+	switch (req->code) {
+	case IPC_SDMMC_READ:
+		req->args[0] = sd_io(req->args[0], req->args[1], get_ptr(req, 2), 0);
+		break;
+	case IPC_SDMMC_WRITE:
+		req->args[0] = sd_io(req->args[0], req->args[1], get_ptr(req, 2), 1);
+		break;
+	case IPC_NAND_READ:
+		req->args[0] = nand_read_page(req->args[0], get_ptr(req, 1),
+			get_ptr(req, 3));
+		break;
+	case IPC_NAND_WRITE:
+		req->args[0] = nand_program_page(req->args[0], get_ptr(req, 1),
+			get_ptr(req, 3));
+		break;
+	default:
+		printf("mini: unhandled request %08x\n", req->code);
+		req->args[0] = -1;
+		break;
+	}
+}
+
+int sd_get_state(void)
+{
+	return sd_fd < 0 ? SDMMC_NO_CARD : SDMMC_INSERTED;
+}
+
+int sd_mount(void)
+{
+	return sd_fd < 0 ? -1 : 0;
+}
+
+u32 sd_getsize(void)
+{
+	return sd_sectors;
+}
+
+int sd_read(u32 start_block, u32 blk_cnt, void *buffer)
+{
+	return sd_io(start_block, blk_cnt, buffer, 0);
+}
+
+int sd_write(u32 start_block, u32 blk_cnt, const void *buffer)
+{
+	return sd_io(start_block, blk_cnt, (void *)buffer, 1);
+}
+
+int sd_read_async(ipc_batch *b, u32 start_block, u32 blk_cnt, void *buffer)
+{
+	ipc_request *req = ipc_batch_add(b, IPC_SDMMC_READ);
+
+	if (!req)
+		return -1;
+	req->args[0] = start_block;
+	req->args[1] = blk_cnt;
+	put_ptr(req, 2, buffer);
+	return 0;
+}
+
+int sd_write_async(ipc_batch *b, u32 start_block, u32 blk_cnt, const void *buffer)
+{
+	ipc_request *req = ipc_batch_add(b, IPC_SDMMC_WRITE);
+
+	if (!req)
+		return -1;
+	req->args[0] = start_block;
+	req->args[1] = blk_cnt;
+	put_ptr(req, 2, buffer);
+	return 0;
+}
+
+static int nand_pages_async(ipc_batch *b, u32 code, u32 pageno, u32 count,
+		u8 *data, u8 *ecc)
+{
+	ipc_request *req;
+	u32 i;
+
+	if (count > IPC_BATCH_MAX - b->count)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		req = ipc_batch_add(b, code);
+		req->args[0] = pageno + i;
+		put_ptr(req, 1, data ? data + i * NAND_DATA : NULL);
+		put_ptr(req, 3, ecc ? ecc + i * NAND_SPARE : NULL);
+	}
+	return 0;
+}
+
+int nand_read_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc)
+{
+	return nand_pages_async(b, IPC_NAND_READ, pageno, count, data, ecc);
+}
+
+int nand_write_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc)
+{
+	return nand_pages_async(b, IPC_NAND_WRITE, pageno, count, data, ecc);
+}
+
+void nand_erase(u32 pageno)
+{
+	u8 raw[NAND_RAW];
+	u32 page = pageno - pageno % NAND_BLOCK, i;
+
+	if (page >= nand_pages || nand_worn[page / NAND_BLOCK])
+		return;
+
+	memset(raw, 0xff, sizeof(raw));
+	for (i = 0; i < NAND_BLOCK; i++)
+		nand_page_io(page + i, raw, 1);
+}
+
+void ipc_batch_init(ipc_batch *b)
+{
+	b->count = 0;
+	b->done = 0;
+}
+
+ipc_request *ipc_batch_add(ipc_batch *b, u32 code)
+{
+	ipc_request *req;
+
+	if (b->count >= IPC_BATCH_MAX)
+		return NULL;
+
+	req = &b->reqs[b->count++];
+	memset(req, 0, sizeof(*req));
+	req->code = code;
+	return req;
+}
+
+// mini serves a batch in order as soon as the doorbell rings; here that
+// happens right away
+void ipc_batch_submit(ipc_batch *b)
+{
+	u32 i;
+
+	for (i = 0; i < b->count; i++)
+		serve(&b->reqs[i]);
+	b->done = 0;
+}
+
+ipc_request *ipc_batch_wait(ipc_batch *b, u32 idx)
+{
+	if (b->done <= idx)
+		b->done = idx + 1 < b->count ? idx + 1 : b->count;
+	return &b->reqs[idx];
+}
@@ -0,0 +1,32 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: mini's side of the IPC calls, served from image files
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __HOST_MINI_H__
+#define __HOST_MINI_H__
+
+#include "types.h"
+
+/* serve the SD card from a raw image of 512 byte sectors. with sectors
+   nonzero a new sparse image of that size is created, otherwise an
+   existing one is used as it is */
+s32 mini_sd_open(const char *path, u32 sectors);
+void mini_sd_close(void);
+
+/* serve the NAND from an existing nand.bin style image, 0x840 bytes per
+   page. programming only clears bits, like on the flash */
+s32 mini_nand_open(const char *path);
+void mini_nand_close(void);
+
+/* from now on, erasing and programming block silently does nothing */
+void mini_nand_wear_out(u32 block);
+
+/* stall every request for us microseconds, like a slow card would */
+void mini_set_latency(u32 us);
+
+#endif
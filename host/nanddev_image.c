@@ -0,0 +1,250 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: nanddev on top of a nand.bin dump
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "mini_ipc.h"
+#include "nanddev.h"
+#include "string.h"
+#include "aes.h"
+#include "hostio.h"
+#include "nanddev_image.h"
+
+#define	CLUSTER_SIZE	0x4000
+
+static int fd = -1;
+static struct aes128 nand_aes;
+static struct nanddev_image_stats stats;
+
+s32 nanddev_image_open(const char *path, const u8 *key)
+{
+	u8 buf[16];
+
+	nanddev_image_close();
+
+	fd = hostio_open(path, HOSTIO_READ);
+	if (fd < 0) {
+		printf("nanddev: can't open %s\n", path);
+		return -1;
+	}
+
+	if (!key) {
+		if (hostio_pread(fd, buf, sizeof(buf), NAND_KEY_OFS)) {
+			printf("nanddev: %s has no keys.bin appended\n", path);
+			nanddev_image_close();
+			return -1;
+		}
+		key = buf;
+	}
+
+	aes128_set_key(&nand_aes, key);
+	return 0;
+}
+
+void nanddev_image_close(void)
+{
+	if (fd >= 0)
+		hostio_close(fd);
+	fd = -1;
+}
+
+static u8 parity(u8 x)
+{
+	u8 y = 0;
+
+	while (x) {
+		y ^= x & 1;
+		x >>= 1;
+	}
+	return y;
+}
+
+// hamming code over 512 bytes: 12 bits for the odd and 12 for the even
+// halves of every bit and byte address, as the flash controller does it
+static void calc_ecc(const u8 *data, u8 *ecc)
+{
+	u8 a[12][2];
+	u32 a0, a1;
+	u8 x;
+	int i, j;
+
+	memset(a, 0, sizeof(a));
+	for (i = 0; i < 512; i++) {
+		x = data[i];
+		for (j = 0; j < 9; j++)
+			a[3 + j][(i >> j) & 1] ^= x;
+	}
+
+	x = a[3][0] ^ a[3][1];
+	a[0][0] = x & 0x55;
+	a[0][1] = x & 0xaa;
+	a[1][0] = x & 0x33;
+	a[1][1] = x & 0xcc;
+	a[2][0] = x & 0x0f;
+	a[2][1] = x & 0xf0;
+
+	a0 = a1 = 0;
+	for (j = 0; j < 12; j++) {
+		a0 |= parity(a[j][0]) << j;
+		a1 |= parity(a[j][1]) << j;
+	}
+
+	ecc[0] = a0;
+	ecc[1] = a0 >> 8;
+	ecc[2] = a1;
+	ecc[3] = a1 >> 8;
+}
+
+void nanddev_image_ecc(const u8 *page, u8 *ecc)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		calc_ecc(page + i*512, ecc + i*4);
+}
+
+static int is_erased(const u8 *raw)
+{
+	int i;
+
+	for (i = 0; i < NAND_RAW_PAGE; i++)
+		if (raw[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+// check and repair one raw page like mini does; returns a NAND_ECC_* code
+static s32 correct_page(u8 *raw)
+{
+	u8 calc[16];
+	u8 *stored = raw + 0x800 + 0x30;
+	u32 s0, s1, syn;
+	s32 ret = NAND_ECC_OK;
+	int i;
+
+	if (is_erased(raw))
+		return NAND_ECC_OK;
+
+	nanddev_image_ecc(raw, calc);
+	for (i = 0; i < 4; i++) {
+		s0 = (stored[i*4] | stored[i*4 + 1] << 8) ^
+			(calc[i*4] | calc[i*4 + 1] << 8);
+		s1 = (stored[i*4 + 2] | stored[i*4 + 3] << 8) ^
+			(calc[i*4 + 2] | calc[i*4 + 3] << 8);
+		syn = s0 | s1 << 12;
+
+		if (syn == 0)
+			continue;
+
+		if ((syn & (syn - 1)) == 0) {
+			// a flipped bit in the ECC itself, the data is fine
+			if (ret == NAND_ECC_OK)
+				ret = NAND_ECC_CORRECTED;
+		} else if ((s0 ^ s1) == 0xfff) {
+			// one flipped data bit: s1 is its bit address within
+			// the 512 bytes, s0 the complement
+			raw[i*512 + (s1 >> 3)] ^= 1 << (s1 & 7);
+			if (ret == NAND_ECC_OK)
+				ret = NAND_ECC_CORRECTED;
+		} else
+			ret = NAND_ECC_UNCORRECTABLE;
+	}
+
+	return ret;
+}
+
+static s32 read_page(u32 pageno, u8 *data, u8 *ecc)
+{
+	u8 raw[NAND_RAW_PAGE];
+	s32 ret;
+
+	// pages past the end of a short image read as erased
+	if (pageno >= NAND_PAGES || fd < 0 ||
+	    hostio_pread(fd, raw, sizeof(raw), (u64)pageno * NAND_RAW_PAGE))
+		memset(raw, 0xff, sizeof(raw));
+
+	stats.pages++;
+	ret = correct_page(raw);
+	if (ret == NAND_ECC_CORRECTED)
+		stats.corrected++;
+	else if (ret == NAND_ECC_UNCORRECTABLE)
+		stats.uncorrectable++;
+
+	if (data)
+		memcpy(data, raw, 0x800);
+	if (ecc)
+		memcpy(ecc, raw + 0x800, 0x40);
+	return ret;
+}
+
+s32 nanddev_initialize(void)
+{
+	return fd >= 0 ? 0 : -1;
+}
+
+s32 nanddev_read(u32 pageno, u32 count, void *data, void *ecc)
+{
+	u8 *d = data, *e = ecc;
+	s32 ret = NAND_ECC_OK, r;
+
+	stats.reads++;
+	while (count--) {
+		r = read_page(pageno++, d, e);
+		// uncorrectable is sticky, otherwise report corrections
+		if (ret != NAND_ECC_UNCORRECTABLE && r != NAND_ECC_OK)
+			ret = r;
+		if (d)
+			d += 0x800;
+		if (e)
+			e += 0x40;
+	}
+
+	return ret;
+}
+
+void nanddev_read_list(const u32 *pages, u32 count, u8 *data, u8 *ecc,
+		s32 *status)
+{
+	u32 i;
+
+	stats.reads++;
+	for (i = 0; i < count; i++)
+		status[i] = read_page(pages[i], data + i*0x800,
+			ecc ? ecc + i*0x40 : NULL);
+}
+
+// nothing runs in the background here: decrypt and read right away
+void nanddev_decrypt_start(u8 *cluster, u32 next_pageno, u8 *next)
+{
+	u8 iv[16] = {0,};
+
+	stats.decrypts++;
+	aes128_cbc_decrypt(&nand_aes, iv, cluster, CLUSTER_SIZE);
+
+	if (next)
+		nanddev_read(next_pageno, 8, next, NULL);
+}
+
+void nanddev_decrypt_wait(u8 *cluster)
+{
+	(void)cluster;
+}
+
+void nanddev_read_wait(void)
+{
+}
+
+void nanddev_image_stats(struct nanddev_image_stats *st)
+{
+	memcpy(st, &stats, sizeof(stats));
+}
+
+void nanddev_image_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,41 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: nanddev on top of a nand.bin dump
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __NANDDEV_IMAGE_H__
+#define __NANDDEV_IMAGE_H__
+
+#include "types.h"
+
+/* a dump is 0x40000 raw pages of 0x800 data and 0x40 spare bytes. BootMii
+   appends its keys.bin, which holds the NAND key at 0x158. */
+#define NAND_RAW_PAGE	0x840
+#define NAND_PAGES	0x40000
+#define NAND_KEYS_OFS	((u64)NAND_PAGES * NAND_RAW_PAGE)
+#define NAND_KEY_OFS	(NAND_KEYS_OFS + 0x158)
+
+struct nanddev_image_stats {
+	u32 reads;		/* nanddev_read and nanddev_read_list calls */
+	u32 pages;		/* pages read from the image */
+	u32 decrypts;		/* clusters decrypted */
+	u32 corrected;		/* pages with a corrected ECC error */
+	u32 uncorrectable;	/* pages ECC could not fix */
+};
+
+/* use the dump at path for the nanddev_* calls; without a key it is taken
+   from the keys.bin appended to the dump */
+s32 nanddev_image_open(const char *path, const u8 *key);
+void nanddev_image_close(void);
+
+/* the 16 ECC bytes the controller stores at spare + 0x30 for a page */
+void nanddev_image_ecc(const u8 *page, u8 *ecc);
+
+void nanddev_image_stats(struct nanddev_image_stats *st);
+void nanddev_image_reset_stats(void);
+
+#endif
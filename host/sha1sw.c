@@ -0,0 +1,119 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: SHA-1 in software, in place of sha1.c which drives the
+	Hollywood SHA engine
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "types.h"
+#include "string.h"
+#include "sha1.h"
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static void transform(unsigned long state[5], const u8 *p)
+{
+	u32 w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = p[4*i] << 24 | p[4*i+1] << 16 | p[4*i+2] << 8 | p[4*i+3];
+	for (; i < 80; i++)
+		w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] = (u32)(state[0] + a);
+	state[1] = (u32)(state[1] + b);
+	state[2] = (u32)(state[2] + c);
+	state[3] = (u32)(state[3] + d);
+	state[4] = (u32)(state[4] + e);
+}
+
+void SHA1Init(SHA1_CTX *context)
+{
+	context->state[0] = 0x67452301;
+	context->state[1] = 0xEFCDAB89;
+	context->state[2] = 0x98BADCFE;
+	context->state[3] = 0x10325476;
+	context->state[4] = 0xC3D2E1F0;
+	context->count[0] = context->count[1] = 0;
+}
+
+// count[] holds the length in bytes here, sha1.c keeps bits
+void SHA1Update(SHA1_CTX *context, unsigned char *data, unsigned int len)
+{
+	u32 j = context->count[0] & 63, n;
+
+	context->count[0] += len;
+
+	while (len) {
+		n = 64 - j < len ? 64 - j : len;
+		memcpy(context->buffer + j, data, n);
+		data += n;
+		len -= n;
+		j += n;
+		if (j == 64) {
+			transform(context->state, context->buffer);
+			j = 0;
+		}
+	}
+}
+
+void SHA1Final(unsigned char digest[20], SHA1_CTX *context)
+{
+	u64 bits = (u64)context->count[0] * 8;
+	u8 tail[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		tail[i] = bits >> (56 - 8 * i);
+
+	SHA1Update(context, (unsigned char *)"\200", 1);
+	while ((context->count[0] & 63) != 56)
+		SHA1Update(context, (unsigned char *)"\0", 1);
+	SHA1Update(context, tail, 8);
+
+	for (i = 0; i < 20; i++)
+		digest[i] = context->state[i >> 2] >> ((3 - (i & 3)) * 8);
+	memset(context, 0, sizeof(*context));
+}
+
+void SHA1(unsigned char *ptr, unsigned int size, unsigned char *outbuf)
+{
+	SHA1_CTX ctx;
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, ptr, size);
+	SHA1Final(outbuf, &ctx);
+}
@@ -0,0 +1,227 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: nand_backup and nand_restore between a NAND image and a
+	file on an SD image
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "fat.h"
+#include "nandbackup.h"
+#include "sha1.h"
+#include "string.h"
+#include "hostio.h"
+#include "mini.h"
+
+#define NAND_IMAGE	"nandbackup_nand.img"
+#define SD_IMAGE	"nandbackup_sd.img"
+#define SD_SECTORS	(64 * 1024 * 2)
+#define BACKUP		"0:/nand.bin"
+
+#define BLOCKS		8
+#define PAGES		(BLOCKS * NAND_BLOCK_PAGES)
+// pages of this block past the first BLANK_FROM are left erased
+#define BLANK_BLOCK	2
+#define BLANK_FROM	10
+
+static u8 page_buf[NAND_RAW_PAGE_SIZE];
+static u8 file_buf[NAND_RAW_PAGE_SIZE];
+static int fd;
+static u32 tests, failures;
+
+#define CHECK(cond) do { \
+	tests++; \
+	if (!(cond)) { \
+		failures++; \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+static void make_page(u32 page, u8 *raw)
+{
+	u32 i;
+
+	if (page / NAND_BLOCK_PAGES == BLANK_BLOCK &&
+	    page % NAND_BLOCK_PAGES >= BLANK_FROM) {
+		memset(raw, 0xff, NAND_RAW_PAGE_SIZE);
+		return;
+	}
+
+	for (i = 0; i < NAND_RAW_PAGE_SIZE; i++)
+		raw[i] = page * 7 + i * 13 + (i >> 8);
+	// good block marker
+	raw[NAND_PAGE_SIZE] = 0xff;
+}
+
+static int build_nand(void)
+{
+	u32 page;
+
+	fd = hostio_open(NAND_IMAGE, HOSTIO_CREATE);
+	if (fd < 0)
+		return -1;
+
+	for (page = 0; page < PAGES; page++) {
+		make_page(page, page_buf);
+		if (hostio_pwrite(fd, page_buf, NAND_RAW_PAGE_SIZE,
+				(u64)page * NAND_RAW_PAGE_SIZE))
+			return -1;
+	}
+
+	return mini_nand_open(NAND_IMAGE);
+}
+
+static void poke(u32 page, u32 ofs, u8 val)
+{
+	hostio_pwrite(fd, &val, 1, (u64)page * NAND_RAW_PAGE_SIZE + ofs);
+}
+
+static u8 peek(u32 page, u32 ofs)
+{
+	u8 val = 0;
+
+	hostio_pread(fd, &val, 1, (u64)page * NAND_RAW_PAGE_SIZE + ofs);
+	return val;
+}
+
+// number of pages that differ between the flash and what it started as
+static u32 flash_changed(void)
+{
+	u32 page, changed = 0;
+
+	for (page = 0; page < PAGES; page++) {
+		make_page(page, file_buf);
+		hostio_pread(fd, page_buf, NAND_RAW_PAGE_SIZE,
+			(u64)page * NAND_RAW_PAGE_SIZE);
+		if (memcmp(page_buf, file_buf, NAND_RAW_PAGE_SIZE))
+			changed++;
+	}
+
+	return changed;
+}
+
+static int mount_sd(void)
+{
+	if (mini_sd_open(SD_IMAGE, SD_SECTORS))
+		return -1;
+	if (fat_mount_drive(0, DISK_SD, 0))
+		return -1;
+	return f_mkfs(0, 1, 0) == FR_OK ? 0 : -1;
+}
+
+static void test_backup(void)
+{
+	struct nand_backup_stats st;
+	SHA1_CTX ctx;
+	u8 sha1[20], expect[20];
+	u32 page, br, bad = 0;
+	FIL fil;
+
+	CHECK(nand_backup(BACKUP, 0, PAGES, sha1, &st) == 0);
+	CHECK(st.pages == PAGES);
+	CHECK(st.ecc_failed == 0);
+
+	SHA1Init(&ctx);
+	CHECK(f_open(&fil, BACKUP, FA_READ) == FR_OK);
+	CHECK(fil.fsize == PAGES * NAND_RAW_PAGE_SIZE);
+	for (page = 0; page < PAGES; page++) {
+		make_page(page, page_buf);
+		SHA1Update(&ctx, page_buf, NAND_RAW_PAGE_SIZE);
+		if (f_read(&fil, file_buf, NAND_RAW_PAGE_SIZE, &br) != FR_OK ||
+		    br != NAND_RAW_PAGE_SIZE ||
+		    memcmp(page_buf, file_buf, NAND_RAW_PAGE_SIZE))
+			bad++;
+	}
+	f_close(&fil);
+	SHA1Final(expect, &ctx);
+
+	CHECK(bad == 0);
+	CHECK(memcmp(sha1, expect, sizeof(sha1)) == 0);
+
+	// a range in the middle lands in the file the same way
+	CHECK(nand_backup("0:/part.bin", 100, 3, NULL, &st) == 0);
+	CHECK(f_open(&fil, "0:/part.bin", FA_READ) == FR_OK);
+	CHECK(f_lseek(&fil, 2 * NAND_RAW_PAGE_SIZE) == FR_OK);
+	CHECK(f_read(&fil, file_buf, NAND_RAW_PAGE_SIZE, &br) == FR_OK);
+	make_page(102, page_buf);
+	CHECK(memcmp(page_buf, file_buf, NAND_RAW_PAGE_SIZE) == 0);
+	f_close(&fil);
+
+	CHECK(nand_backup("0:/x.bin", NAND_PAGES, 1, NULL, &st) < 0);
+}
+
+static void test_restore(void)
+{
+	struct nand_restore_stats st;
+	u32 page;
+
+	// nothing changed, nothing gets touched
+	CHECK(nand_restore(BACKUP, 0, BLOCKS, &st, NULL) == 0);
+	CHECK(st.blocks == BLOCKS);
+	CHECK(st.blocks_skipped == BLOCKS);
+	CHECK(st.blocks_written == 0);
+
+	// a changed byte rewrites its block, blank pages aren't programmed
+	poke(3 * NAND_BLOCK_PAGES + 5, 100, 0x00);
+	poke(BLANK_BLOCK * NAND_BLOCK_PAGES + BLANK_FROM + 1, 7, 0x12);
+	CHECK(flash_changed() == 2);
+	CHECK(nand_restore(BACKUP, 0, BLOCKS, &st, NULL) == 0);
+	CHECK(st.blocks_written == 2);
+	CHECK(st.blocks_skipped == BLOCKS - 2);
+	CHECK(st.pages_written == NAND_BLOCK_PAGES + BLANK_FROM);
+	CHECK(st.verify_failed == 0);
+	CHECK(flash_changed() == 0);
+
+	// a block the flash marks bad is never erased, whatever the image says
+	page = 5 * NAND_BLOCK_PAGES;
+	poke(page, NAND_PAGE_SIZE, 0x00);
+	poke(page + 3, 0, ~peek(page + 3, 0));
+	CHECK(nand_restore(BACKUP, 0, BLOCKS, &st, NULL) == 0);
+	CHECK(st.blocks_bad == 1);
+	CHECK(st.blocks_written == 0);
+	CHECK(peek(page, NAND_PAGE_SIZE) == 0x00);
+	CHECK(flash_changed() == 2);
+	poke(page, NAND_PAGE_SIZE, 0xff);
+	make_page(page + 3, page_buf);
+	poke(page + 3, 0, page_buf[0]);
+
+	// a block that doesn't take the erase fails the verify; the blocks
+	// after it are still restored
+	mini_nand_wear_out(6);
+	poke(6 * NAND_BLOCK_PAGES + 1, 0, 0x00);
+	poke(7 * NAND_BLOCK_PAGES + 1, 0, 0x00);
+	CHECK(nand_restore(BACKUP, 0, BLOCKS, &st, NULL) < 0);
+	CHECK(st.blocks == BLOCKS);
+	CHECK(st.verify_failed == 1);
+	CHECK(st.blocks_written == 2);
+	CHECK(flash_changed() == 1);
+
+	// only the requested blocks are looked at
+	CHECK(nand_restore(BACKUP, 7, 1, &st, NULL) == 0);
+	CHECK(st.blocks == 1 && st.blocks_skipped == 1);
+	CHECK(nand_restore(BACKUP, 7, 2, &st, NULL) < 0);
+}
+
+int main(void)
+{
+	if (build_nand() || mount_sd()) {
+		printf("can't set up the images\n");
+		return 1;
+	}
+
+	test_backup();
+	test_restore();
+
+	fat_umount_drive(0);
+	mini_sd_close();
+	mini_nand_close();
+	hostio_close(fd);
+	hostio_unlink(SD_IMAGE);
+	hostio_unlink(NAND_IMAGE);
+
+	printf("%u checks, %u failed\n", tests, failures);
+	return failures ? 1 : 0;
+}
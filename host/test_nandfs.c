@@ -0,0 +1,577 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+
+	host build: nandfs tests on a generated nand.bin
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "mini_ipc.h"
+#include "nanddev.h"
+#include "nandfs.h"
+#include "string.h"
+#include "aes.h"
+#include "hostio.h"
+#include "nanddev_image.h"
+
+#define IMAGE		"nandfs_test.bin"
+#define CLUSTER		0x4000
+#define SFFS_FIRST	0x7F00
+#define SFFS_SIZE	0x40000
+#define FST_OFS		(12 + 0x10000)
+#define CHAIN_END	0xFFFB
+#define NO_NODE		0xFFFF
+
+static const u8 nand_key[16] = {
+	0x13, 0x37, 0xb0, 0x07, 0x4d, 0x11, 0x1e, 0x55,
+	0x0a, 0xce, 0x5e, 0xed, 0xfa, 0xde, 0xd0, 0x0d,
+};
+
+static u8 sb[SFFS_SIZE];
+static u8 cluster[CLUSTER];
+static u8 buf[40 * CLUSTER];
+static int fd;
+static u32 tests, failures;
+
+#define CHECK(cond) do { \
+	tests++; \
+	if (!(cond)) { \
+		failures++; \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+// the files of the generated filesystem
+#define FILE_A		1
+#define FILE_FULL	2
+#define FILE_B		4
+
+static const u16 chain_a[] = { 100, 57, 300, 12 };
+static const u16 chain_full[] = { 400, 401 };
+static u16 chain_b[40];
+
+#define SIZE_A		(3 * CLUSTER + 1000)
+#define SIZE_FULL	(2 * CLUSTER)
+#define SIZE_B		(40 * CLUSTER - 5)
+
+static u8 pattern(u32 file, u32 off)
+{
+	return off * 7 + file * 13 + (off >> 11);
+}
+
+static int matches(u32 file, u32 off, const u8 *p, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		if (p[i] != pattern(file, off + i))
+			return 0;
+	return 1;
+}
+
+static void put16(u8 *p, u16 x)
+{
+	p[0] = x >> 8;
+	p[1] = x;
+}
+
+static void put32(u8 *p, u32 x)
+{
+	put16(p, x >> 16);
+	put16(p + 2, x);
+}
+
+static void write_page(u32 pageno, const u8 *data, int flip_data, int flip_ecc)
+{
+	u8 raw[NAND_RAW_PAGE];
+
+	memcpy(raw, data, 0x800);
+	memset(raw + 0x800, 0, 0x40);
+	raw[0x800] = 0xff;
+	nanddev_image_ecc(raw, raw + 0x830);
+
+	// flip_* are bit numbers + 1 within the page / ECC bytes
+	if (flip_data)
+		raw[(flip_data - 1) >> 3] ^= 1 << ((flip_data - 1) & 7);
+	if (flip_ecc)
+		raw[0x830 + ((flip_ecc - 1) >> 3)] ^= 1 << ((flip_ecc - 1) & 7);
+
+	hostio_pwrite(fd, raw, sizeof(raw), (u64)pageno * NAND_RAW_PAGE);
+}
+
+static void write_file(u32 file, const u16 *chain, u32 size)
+{
+	struct aes128 aes;
+	u8 iv[16];
+	u32 c, i;
+
+	aes128_set_key(&aes, nand_key);
+	for (c = 0; c * CLUSTER < size; c++) {
+		for (i = 0; i < CLUSTER; i++)
+			cluster[i] = pattern(file, c * CLUSTER + i);
+		memset(iv, 0, sizeof(iv));
+		aes128_cbc_encrypt(&aes, iv, cluster, CLUSTER);
+		for (i = 0; i < 8; i++)
+			write_page(chain[c] * 8 + i, cluster + i * 0x800, 0, 0);
+	}
+}
+
+static void set_chain(const u16 *chain, u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		put16(sb + 12 + chain[i] * 2, i + 1 < n ? chain[i + 1] : CHAIN_END);
+}
+
+static void set_node(u32 n, const char *name, u8 attr, u16 first,
+		u16 sibling, u32 size)
+{
+	u8 *p = sb + FST_OFS + n * 0x20;
+
+	memset(p, 0, 0x20);
+	memcpy(p, name, strnlen(name, NANDFS_NAME_LEN));
+	p[12] = attr;
+	put16(p + 14, first);
+	put16(p + 16, sibling);
+	put32(p + 18, size);
+}
+
+static void write_superblock(u32 slot, u32 version, const char *root,
+		u32 size_a, int bad_header)
+{
+	u32 i, page0 = (SFFS_FIRST + slot * 16) * 8;
+
+	memset(sb, 0, sizeof(sb));
+	memcpy(sb, "SFFS", 4);
+	put32(sb + 4, version);
+	for (i = 0; i < 32768; i++)
+		put16(sb + 12 + i * 2, 0xFFFE);
+	set_chain(chain_a, 4);
+	set_chain(chain_full, 2);
+	set_chain(chain_b, 40);
+
+	set_node(0, root, NANDFS_ATTR_DIR, 1, NO_NODE, 0);
+	set_node(1, "a.bin", NANDFS_ATTR_FILE, chain_a[0], 2, size_a);
+	set_node(2, "full.bin", NANDFS_ATTR_FILE, chain_full[0], 3, SIZE_FULL);
+	set_node(3, "dir", NANDFS_ATTR_DIR, 4, NO_NODE, 0);
+	set_node(4, "b.bin", NANDFS_ATTR_FILE, chain_b[0], 5, SIZE_B);
+	set_node(5, "sub", NANDFS_ATTR_DIR, NO_NODE, NO_NODE, 0);
+
+	for (i = 0; i < SFFS_SIZE / 0x800; i++)
+		write_page(page0 + i, sb + i * 0x800, 0, 0);
+	// two flipped bits in one 512 byte block can't be corrected
+	if (bad_header) {
+		u8 raw[NAND_RAW_PAGE];
+
+		hostio_pread(fd, raw, sizeof(raw), (u64)page0 * NAND_RAW_PAGE);
+		raw[200] ^= 0x11;
+		hostio_pwrite(fd, raw, sizeof(raw), (u64)page0 * NAND_RAW_PAGE);
+	}
+}
+
+static int build_image(void)
+{
+	u32 i;
+
+	fd = hostio_open(IMAGE, HOSTIO_CREATE);
+	if (fd < 0)
+		return -1;
+	// sparse, only the pages written below take up space
+	hostio_truncate(fd, NAND_KEYS_OFS);
+
+	for (i = 0; i < 40; i++)
+		chain_b[i] = 1000 + 3 * i;
+
+	write_file(FILE_A, chain_a, SIZE_A);
+	write_file(FILE_FULL, chain_full, SIZE_FULL);
+	write_file(FILE_B, chain_b, SIZE_B);
+
+	// slot 3 is the good one. the newer slot 7 has a broken FST and the
+	// even newer slot 10 an unreadable header page, so both get skipped.
+	write_superblock(3, 5, "/", SIZE_A, 0);
+	write_superblock(7, 9, "x", SIZE_A, 0);
+	write_superblock(10, 12, "/", SIZE_A + 1, 1);
+
+	hostio_close(fd);
+	return 0;
+}
+
+static void test_aes(void)
+{
+	static const u8 key[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	};
+	static const u8 pt[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+	};
+	// FIPS-197 appendix C.1
+	static const u8 ct[16] = {
+		0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+		0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a,
+	};
+	struct aes128 aes;
+	u8 iv[16], b[64];
+	u32 i;
+
+	aes128_set_key(&aes, key);
+
+	memcpy(b, pt, 16);
+	memset(iv, 0, sizeof(iv));
+	aes128_cbc_encrypt(&aes, iv, b, 16);
+	CHECK(memcmp(b, ct, 16) == 0);
+
+	memset(iv, 0, sizeof(iv));
+	aes128_cbc_decrypt(&aes, iv, b, 16);
+	CHECK(memcmp(b, pt, 16) == 0);
+
+	for (i = 0; i < sizeof(b); i++)
+		b[i] = i;
+	memset(iv, 0, sizeof(iv));
+	aes128_cbc_encrypt(&aes, iv, b, sizeof(b));
+	memset(iv, 0, sizeof(iv));
+	aes128_cbc_decrypt(&aes, iv, b, sizeof(b));
+	for (i = 0; i < sizeof(b) && b[i] == i; i++)
+		;
+	CHECK(i == sizeof(b));
+}
+
+static void test_ecc(void)
+{
+	u8 page[0x800], out[0x800], raw[NAND_RAW_PAGE];
+	u32 i;
+
+	for (i = 0; i < sizeof(page); i++)
+		page[i] = pattern(9, i);
+
+	fd = hostio_open(IMAGE "-ecc", HOSTIO_CREATE);
+	CHECK(fd >= 0);
+	write_page(20, page, 0, 0);
+	write_page(21, page, 1 + 1234, 0);
+	write_page(22, page, 0, 1 + 77);
+	write_page(23, page, 0, 0);
+
+	// two flipped bits in the same 512 byte block
+	hostio_pread(fd, raw, sizeof(raw), 23ULL * NAND_RAW_PAGE);
+	raw[600] ^= 0x81;
+	hostio_pwrite(fd, raw, sizeof(raw), 23ULL * NAND_RAW_PAGE);
+	hostio_close(fd);
+
+	CHECK(nanddev_image_open(IMAGE "-ecc", nand_key) == 0);
+
+	CHECK(nanddev_read(20, 1, out, NULL) == NAND_ECC_OK);
+	CHECK(memcmp(out, page, sizeof(page)) == 0);
+
+	CHECK(nanddev_read(21, 1, out, NULL) == NAND_ECC_CORRECTED);
+	CHECK(memcmp(out, page, sizeof(page)) == 0);
+
+	CHECK(nanddev_read(22, 1, out, NULL) == NAND_ECC_CORRECTED);
+	CHECK(memcmp(out, page, sizeof(page)) == 0);
+
+	CHECK(nanddev_read(23, 1, out, NULL) == NAND_ECC_UNCORRECTABLE);
+
+	// the worst status of a run wins
+	CHECK(nanddev_read(20, 4, buf, NULL) == NAND_ECC_UNCORRECTABLE);
+
+	// an erased page is not an error
+	CHECK(nanddev_read(NAND_PAGES - 1, 1, out, NULL) == NAND_ECC_OK);
+
+	nanddev_image_close();
+	hostio_unlink(IMAGE "-ecc");
+}
+
+static s32 mount(void)
+{
+	if (nanddev_image_open(IMAGE, nand_key))
+		return -1;
+	return nandfs_initialize();
+}
+
+static void test_open_read(void)
+{
+	struct nandfs_fp fp;
+	u32 off, n, nodes, us;
+
+	CHECK(mount() == 0);
+	nandfs_index_stats(&nodes, &us);
+	CHECK(nodes == 0 && us == 0);
+
+	CHECK(nandfs_open(&fp, "/nope") < 0);
+	// the first lookup indexed everything below the root
+	nandfs_index_stats(&nodes, &us);
+	CHECK(nodes == 5);
+	CHECK(nandfs_open(&fp, "/dir") < 0);
+	CHECK(nandfs_open(&fp, "/dir/nope") < 0);
+	CHECK(nandfs_open(&fp, "/a.bin/x") < 0);
+
+	// slot 3 got mounted: slot 10 would make a.bin a byte longer
+	CHECK(nandfs_open(&fp, "/a.bin") == 0);
+	CHECK(fp.size == SIZE_A);
+
+	memset(buf, 0, SIZE_A);
+	CHECK(nandfs_read(buf, SIZE_A, 1, &fp) == SIZE_A);
+	CHECK(matches(FILE_A, 0, buf, SIZE_A));
+	CHECK(nandfs_read(buf, 1, 1, &fp) == 0);
+
+	// odd sized pieces across the cluster boundaries
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+	CHECK(fp.size == SIZE_B);
+	for (off = 0; off < SIZE_B; off += n) {
+		n = SIZE_B - off < 7777 ? SIZE_B - off : 7777;
+		if (nandfs_read(buf, n, 1, &fp) != (s32)n ||
+		    !matches(FILE_B, off, buf, n))
+			break;
+	}
+	CHECK(off == SIZE_B);
+}
+
+static void test_seek(void)
+{
+	struct nandfs_fp fp;
+	u32 c, off, seed = 1, bad = 0;
+	int d;
+
+	CHECK(mount() == 0);
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+
+	// both sides of every cluster boundary
+	for (c = 1; c < 40; c++) {
+		for (d = -3; d <= 3; d += 6) {
+			off = c * CLUSTER + d;
+			if (nandfs_seek(&fp, off, NANDFS_SEEK_SET) ||
+			    nandfs_read(buf, 6, 1, &fp) != 6 ||
+			    !matches(FILE_B, off, buf, 6))
+				bad++;
+		}
+	}
+	CHECK(bad == 0);
+
+	for (c = 0; c < 200; c++) {
+		seed = seed * 1103515245 + 12345;
+		off = (seed >> 8) % (SIZE_B - 100);
+		if (nandfs_seek(&fp, off, NANDFS_SEEK_SET) ||
+		    nandfs_read(buf, 100, 1, &fp) != 100 ||
+		    !matches(FILE_B, off, buf, 100))
+			bad++;
+	}
+	CHECK(bad == 0);
+
+	CHECK(nandfs_seek(&fp, 5 * CLUSTER, NANDFS_SEEK_SET) == 0);
+	CHECK(nandfs_seek(&fp, -CLUSTER - 10, NANDFS_SEEK_CUR) == 0);
+	CHECK(fp.offset == 4 * CLUSTER - 10);
+	CHECK(nandfs_read(buf, 20, 1, &fp) == 20);
+	CHECK(matches(FILE_B, 4 * CLUSTER - 10, buf, 20));
+
+	CHECK(nandfs_seek(&fp, -100, NANDFS_SEEK_END) == 0);
+	CHECK(nandfs_read(buf, 100, 1, &fp) == 100);
+	CHECK(matches(FILE_B, SIZE_B - 100, buf, 100));
+	CHECK(nandfs_read(buf, 1, 1, &fp) == 0);
+
+	CHECK(nandfs_seek(&fp, SIZE_B + 1, NANDFS_SEEK_SET) < 0);
+	CHECK(nandfs_seek(&fp, 1, NANDFS_SEEK_END) < 0);
+	CHECK(nandfs_seek(&fp, -1, NANDFS_SEEK_SET) < 0);
+
+	// the end of a file that fills its last cluster stays on that cluster
+	CHECK(nandfs_open(&fp, "/full.bin") == 0);
+	CHECK(nandfs_seek(&fp, 0, NANDFS_SEEK_END) == 0);
+	CHECK(fp.cur_cluster == chain_full[1]);
+	CHECK(nandfs_read(buf, 1, 1, &fp) == 0);
+	CHECK(nandfs_seek(&fp, -10, NANDFS_SEEK_CUR) == 0);
+	CHECK(nandfs_read(buf, 10, 1, &fp) == 10);
+	CHECK(matches(FILE_FULL, SIZE_FULL - 10, buf, 10));
+}
+
+static void test_chain_map(void)
+{
+	struct nandfs_fp fp;
+	struct nanddev_image_stats st;
+	u32 c, bad = 0;
+
+	CHECK(mount() == 0);
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+
+	// the first seek builds the map from the cluster table
+	nanddev_image_reset_stats();
+	CHECK(nandfs_seek(&fp, 39 * CLUSTER, NANDFS_SEEK_SET) == 0);
+	CHECK(fp.cur_cluster == chain_b[39]);
+	nanddev_image_stats(&st);
+	CHECK(st.pages > 0);
+
+	// after that seeking anywhere in the file never touches the flash
+	nanddev_image_reset_stats();
+	for (c = 40; c-- > 0; ) {
+		if (nandfs_seek(&fp, c * CLUSTER + 1, NANDFS_SEEK_SET) ||
+		    fp.cur_cluster != chain_b[c])
+			bad++;
+	}
+	nanddev_image_stats(&st);
+	CHECK(bad == 0);
+	CHECK(st.pages == 0);
+
+	// a reopened file finds its map again
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+	nanddev_image_reset_stats();
+	CHECK(nandfs_seek(&fp, 20 * CLUSTER, NANDFS_SEEK_SET) == 0);
+	CHECK(fp.cur_cluster == chain_b[20]);
+	nanddev_image_stats(&st);
+	CHECK(st.pages == 0);
+}
+
+// read a few bytes from the start of cluster c of b.bin
+static void touch(struct nandfs_fp *fp, u32 c)
+{
+	nandfs_seek(fp, c * CLUSTER, NANDFS_SEEK_SET);
+	nandfs_read(buf, 16, 1, fp);
+}
+
+static void test_cache(void)
+{
+	struct nandfs_fp fp;
+	struct nanddev_image_stats st;
+	u32 hits, misses, hits0, misses0, pf, pf0, c;
+
+	CHECK(mount() == 0);
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+	// get the chain map out of the way so only cluster reads are counted
+	nandfs_seek(&fp, 39 * CLUSTER, NANDFS_SEEK_SET);
+	nandfs_cache_stats(&hits0, &pf0, &misses0);
+
+	// fill every slot
+	nanddev_image_reset_stats();
+	for (c = 0; c < NANDFS_CACHE_CLUSTERS; c++)
+		touch(&fp, c);
+	nandfs_cache_stats(&hits, &pf, &misses);
+	nanddev_image_stats(&st);
+	CHECK(misses - misses0 == NANDFS_CACHE_CLUSTERS);
+	CHECK(hits == hits0);
+	CHECK(st.pages == NANDFS_CACHE_CLUSTERS * 8);
+	CHECK(st.decrypts == NANDFS_CACHE_CLUSTERS);
+
+	// hits cost nothing
+	nanddev_image_reset_stats();
+	for (c = 0; c < NANDFS_CACHE_CLUSTERS; c++)
+		touch(&fp, c);
+	nandfs_cache_stats(&hits, &pf, &misses);
+	nanddev_image_stats(&st);
+	CHECK(hits - hits0 == NANDFS_CACHE_CLUSTERS);
+	CHECK(st.pages == 0);
+	CHECK(st.decrypts == 0);
+	CHECK(matches(FILE_B, (NANDFS_CACHE_CLUSTERS - 1) * CLUSTER, buf, 16));
+
+	// cluster 0 was used last longest ago, but touching it again makes
+	// cluster 1 the victim for the next new one
+	touch(&fp, 0);
+	touch(&fp, NANDFS_CACHE_CLUSTERS);
+	nandfs_cache_stats(&hits0, &pf0, &misses0);
+	touch(&fp, 0);
+	nandfs_cache_stats(&hits, &pf, &misses);
+	CHECK(hits == hits0 + 1 && misses == misses0);
+	touch(&fp, 1);
+	nandfs_cache_stats(&hits, &pf, &misses);
+	CHECK(misses == misses0 + 1);
+	CHECK(matches(FILE_B, CLUSTER, buf, 16));
+
+	// a long read fetches each next cluster behind the decryption of
+	// the current one and still reads every cluster exactly once
+	CHECK(mount() == 0);
+	CHECK(nandfs_open(&fp, "/dir/b.bin") == 0);
+	nanddev_image_reset_stats();
+	nandfs_cache_stats(&hits0, &pf0, &misses0);
+	memset(buf, 0, SIZE_B);
+	CHECK(nandfs_read(buf, SIZE_B, 1, &fp) == SIZE_B);
+	CHECK(matches(FILE_B, 0, buf, SIZE_B));
+	nanddev_image_stats(&st);
+	CHECK(st.decrypts == 40);
+	nandfs_cache_stats(&hits, &pf, &misses);
+	CHECK(misses - misses0 == 1);
+	CHECK(pf - pf0 == 39);
+	CHECK(hits == hits0);
+}
+
+static char walked[256];
+
+static s32 walk_cb(const char *path, u8 attr, u32 size, void *arg)
+{
+	u32 *files = arg;
+
+	if (attr == NANDFS_ATTR_FILE)
+		(*files)++;
+	(void)size;
+	strlcat(walked, path, sizeof(walked));
+	strlcat(walked, " ", sizeof(walked));
+	return 0;
+}
+
+static void test_walk(void)
+{
+	u32 files = 0;
+
+	CHECK(mount() == 0);
+	walked[0] = 0;
+	CHECK(nandfs_walk("/", walk_cb, &files) == 0);
+	CHECK(files == 3);
+	CHECK(strcmp(walked, "/a.bin /full.bin /dir /dir/b.bin /dir/sub ") == 0);
+
+	walked[0] = 0;
+	CHECK(nandfs_walk("/dir/", walk_cb, &files) == 0);
+	CHECK(strcmp(walked, "/dir/b.bin /dir/sub ") == 0);
+
+	CHECK(nandfs_walk("/a.bin", walk_cb, &files) < 0);
+}
+
+static s32 count_cb(const char *path, u8 attr, u32 size, void *arg)
+{
+	u32 *n = arg;
+
+	(void)path;
+	(void)attr;
+	(void)size;
+	n[0]++;
+	n[1] += size;
+	return 0;
+}
+
+// mount a real dump with its keys.bin and list it
+static int scan_dump(const char *path)
+{
+	u32 n[2] = {0, 0};
+	u64 start;
+
+	if (nanddev_image_open(path, NULL) || nandfs_initialize())
+		return 1;
+
+	start = mftb();
+	nandfs_walk("/", count_cb, n);
+	printf("%s: %u nodes, %u KB in files, walked in %u us\n", path,
+		n[0], n[1] / 1024, (u32)((mftb() - start) / TICKS_PER_USEC));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		return scan_dump(argv[1]);
+
+	if (build_image()) {
+		printf("can't create " IMAGE "\n");
+		return 1;
+	}
+
+	test_aes();
+	test_ecc();
+	test_open_read();
+	test_seek();
+	test_chain_map();
+	test_cache();
+	test_walk();
+
+	nanddev_image_close();
+	hostio_unlink(IMAGE);
+
+	printf("%u checks, %u failed\n", tests, failures);
+	return failures ? 1 : 0;
+}
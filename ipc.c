@@ -12,6 +12,7 @@ Copyright (C) 2009		John Kelley <wiidev@kelley.ca>
 
 #include "bootmii_ppc.h"
 #include "ipc.h"
+#include "irq.h"
 #include "string.h"
 #include <stdarg.h>
 
@@ -26,6 +27,51 @@ static int initialized = 0;
 static u16 out_head;
 static u16 in_tail;
 
+// longest ipc_receive dozes before it looks at out_queue by hand
+#define		IPC_IDLE_US			10000
+
+// replies drained from out_queue by the IPC IRQ, waiting to be picked up
+#define		IPC_CQ_SIZE			16
+static volatile ipc_request cq[IPC_CQ_SIZE];
+static volatile u16 cq_head;
+static volatile u16 cq_tail;
+// set when the IRQ had to leave replies in out_queue because cq was full
+static volatile int cq_stalled;
+
+// most replies ipc_exchange_batch leaves outstanding
+#define		IPC_WINDOW_MAX		16
+
+// tagged replies that arrived while we were waiting for a different one.
+// batch replies never land here, so this only has to hold an
+// ipc_exchange_batch window plus a batch worth of ipc_post/ipc_exchange
+// replies from nested waiters
+#define		IPC_STASH_SIZE		(IPC_BATCH_MAX + IPC_WINDOW_MAX)
+static ipc_request stash[IPC_STASH_SIZE];
+static u8 stash_used[IPC_STASH_SIZE];
+
+// submitted batches that still have replies due
+static ipc_batch *pending;
+
+// interrupt enable bits we have to keep set on every write to HW_IPC_PPCCTRL
+static u32 ctrl_irqmask;
+
+// per-code latency statistics, see ipc_stats_dump()
+#define		IPC_STATS_CODES		32
+#define		IPC_STATS_INFLIGHT	32
+static struct {
+	u32 posts;
+	u32 doorbells;
+	u32 stalls;
+	u64 stall_ticks;
+	u32 untracked;
+	struct ipc_code_stats codes[IPC_STATS_CODES];
+	struct {
+		u32 code;
+		u32 tag;
+		u64 posted;
+	} inflight[IPC_STATS_INFLIGHT];
+} stats;
+
 typedef const struct {
 	char magic[3];
 	char version;
@@ -105,8 +151,21 @@ int ipc_initialize(void)
 	printf("IPC: initial in tail: %d, out head: %d\n", in_tail, out_head);
 
 	cur_tag = 1;
+	pending = NULL;
+	memset(stash_used, 0, sizeof(stash_used));
+
+	cq_head = cq_tail = 0;
+	cq_stalled = 0;
+	ctrl_irqmask = 0;
 
 	initialized = 1;
+
+#ifdef CAN_HAZ_IRQ
+	ctrl_irqmask = IPC_CTRL_INT_RECV;
+	write32(HW_IPC_PPCCTRL, IPC_CTRL_RECV | ctrl_irqmask);
+	irq_hw_enable(IRQ_PPCIPC);
+#endif
+
 	return 0;
 }
 
@@ -115,39 +174,190 @@ void ipc_shutdown(void)
 	if(!initialized)
 		return;
 	ipc_flush();
+#ifdef CAN_HAZ_IRQ
+	irq_hw_disable(IRQ_PPCIPC);
+	ctrl_irqmask = 0;
+	write32(HW_IPC_PPCCTRL, IPC_CTRL_RECV);
+#endif
 	initialized = 0;
 }
 
+static struct ipc_code_stats *ipc_stats_code(u32 code)
+{
+	int i;
+
+	for(i = 0; i < IPC_STATS_CODES; i++) {
+		if(stats.codes[i].posts == 0)
+			stats.codes[i].code = code;
+		if(stats.codes[i].code == code)
+			return &stats.codes[i];
+	}
+
+	stats.untracked++;
+	return NULL;
+}
+
+static void ipc_stats_post(u32 code, u32 tag)
+{
+	struct ipc_code_stats *cs = ipc_stats_code(code);
+
+	stats.posts++;
+	if(cs)
+		cs->posts++;
+
+	// untagged requests don't get a reply we could time
+	if(tag != 0) {
+		stats.inflight[tag % IPC_STATS_INFLIGHT].code = code;
+		stats.inflight[tag % IPC_STATS_INFLIGHT].tag = tag;
+		stats.inflight[tag % IPC_STATS_INFLIGHT].posted = mftb();
+	}
+}
+
+static void ipc_stats_reply(const ipc_request *rep)
+{
+	struct ipc_code_stats *cs;
+	u32 us, bucket;
+
+	if(rep->tag == 0 ||
+	   stats.inflight[rep->tag % IPC_STATS_INFLIGHT].tag != rep->tag ||
+	   stats.inflight[rep->tag % IPC_STATS_INFLIGHT].code != rep->code)
+		return;
+
+	cs = ipc_stats_code(rep->code);
+	if(!cs)
+		return;
+
+	us = (mftb() - stats.inflight[rep->tag % IPC_STATS_INFLIGHT].posted) / TICKS_PER_USEC;
+	stats.inflight[rep->tag % IPC_STATS_INFLIGHT].tag = 0;
+
+	bucket = us ? 32 - __builtin_clz(us) : 0;
+	if(bucket >= IPC_STATS_BUCKETS)
+		bucket = IPC_STATS_BUCKETS - 1;
+
+	cs->replies++;
+	cs->total_us += us;
+	if(us > cs->max_us)
+		cs->max_us = us;
+	cs->hist[bucket]++;
+}
+
+// wait for about us microseconds. with IRQs on, doze through it instead
+// of spinning; any IRQ, a reply from mini included, ends it early
+static void ipc_idle(u32 us)
+{
+	u32 cookie;
+
+	if(!irq_enabled()) {
+		udelay(us);
+		return;
+	}
+
+	cookie = irq_kill();
+	irq_wait(us * TICKS_PER_USEC);
+	irq_restore(cookie);
+}
+
+// number of free slots in in_queue. one slot always stays empty so that
+// a full queue can be told apart from an empty one.
+static inline u32 ipc_in_free(void)
+{
+	return (peek_inhead() - in_tail - 1) & (in_size-1);
+}
+
+static void ipc_wait_inqueue(void)
+{
+	int n = 0;
+
+	u64 start;
+
+	if(ipc_in_free() != 0)
+		return;
+
+	stats.stalls++;
+	start = mftb();
+
+	printf("IPC: in queue full, spinning\n");
+	while(ipc_in_free() == 0) {
+		ipc_idle(10);
+		if(n++ > 20000) {
+			printf("IPC: ARM might be stuck, still waiting for inhead %d != %d\n",
+				peek_inhead(), ((in_tail + 1)&(in_size-1)));
+			n = 0;
+		}
+	}
+
+	stats.stall_ticks += mftb() - start;
+}
+
+// flush the count requests written starting at in_queue[first], publish
+// the new in_tail and ring the doorbell once for all of them
+static void ipc_ring(u16 first, u32 count)
+{
+	u32 n = count;
+
+	if(first + count > (u32)in_size) {
+		n = in_size - first;
+		sync_after_write((void*)&in_queue[0], (count - n) * sizeof(ipc_request));
+	}
+	sync_after_write((void*)&in_queue[first], n * sizeof(ipc_request));
+
+	poke_intail(in_tail);
+	write32(HW_IPC_PPCCTRL, IPC_CTRL_SEND | ctrl_irqmask);
+	stats.doorbells++;
+}
+
 void ipc_vpost(u32 code, u32 tag, u32 num_args, va_list ap)
 {
 	int arg = 0;
-	int n = 0;
+	u16 first;
 
 	if(!initialized) {
 		printf("IPC: not inited\n");
 		return;
 	}
 
-	if(peek_inhead() == ((in_tail + 1)&(in_size-1))) {
-		printf("IPC: in queue full, spinning\n");
-		while(peek_inhead() == ((in_tail + 1)&(in_size-1))) {
-			udelay(10);
-			if(n++ > 20000) {
-				printf("IPC: ARM might be stuck, still waiting for inhead %d != %d\n",
-					peek_inhead(), ((in_tail + 1)&(in_size-1)));
-				n = 0;
-			}
-		}
-	}
+	ipc_wait_inqueue();
+
+	ipc_stats_post(code, tag);
+
+	first = in_tail;
 	in_queue[in_tail].code = code;
 	in_queue[in_tail].tag = tag;
 	while(num_args--) {
 		in_queue[in_tail].args[arg++] = va_arg(ap, u32);
 	}
-	sync_after_write((void*)&in_queue[in_tail], 32);
 	in_tail = (in_tail+1)&(in_size-1);
-	poke_intail(in_tail);
-	write32(HW_IPC_PPCCTRL, IPC_CTRL_SEND);
+	ipc_ring(first, 1);
+}
+
+void ipc_post_batch(const ipc_request *reqs, u32 count)
+{
+	u32 i, n;
+	u16 first;
+
+	if(!initialized) {
+		printf("IPC: not inited\n");
+		return;
+	}
+
+	while(count) {
+		ipc_wait_inqueue();
+
+		n = ipc_in_free();
+		if(n > count)
+			n = count;
+
+		first = in_tail;
+		for(i = 0; i < n; i++) {
+			ipc_stats_post(reqs[i].code, reqs[i].tag);
+			in_queue[in_tail] = reqs[i];
+			in_tail = (in_tail+1)&(in_size-1);
+		}
+		ipc_ring(first, n);
+
+		reqs += n;
+		count -= n;
+	}
 }
 
 void ipc_post(u32 code, u32 tag, u32 num_args, ...)
@@ -171,7 +381,7 @@ void ipc_flush(void)
 		return;
 	}
 	while(peek_inhead() != in_tail) {
-		udelay(10);
+		ipc_idle(10);
 		if(n++ > 20000) {
 			printf("IPC: ARM might be stuck, still waiting for inhead %d == intail %d\n",
 				peek_inhead(), in_tail);
@@ -183,14 +393,79 @@ void ipc_flush(void)
 // last IPC message received, copied because we need to make space in the queue
 ipc_request req_recv;
 
-// since we're not using IRQs, we don't use the reception bell at all at the moment
+// handlers for messages mini sends on its own, looked up by code
+#define		IPC_MAX_HANDLERS	8
+static struct {
+	u32 code;
+	ipc_handler handler;
+} handlers[IPC_MAX_HANDLERS];
+
+// move everything mini has posted so far from out_queue to the completion
+// queue. must be called with IRQs disabled.
+static void ipc_drain(void)
+{
+	u16 next;
+
+	cq_stalled = 0;
+	while(peek_outtail() != out_head) {
+		next = (cq_tail + 1) & (IPC_CQ_SIZE - 1);
+		if(next == cq_head) {
+			cq_stalled = 1;
+			break;
+		}
+
+		sync_before_read((void*)&out_queue[out_head], 32);
+		cq[cq_tail] = out_queue[out_head];
+		cq_tail = next;
+
+		out_head = (out_head+1)&(out_size-1);
+		poke_outhead(out_head);
+	}
+}
+
+void ipc_irq(void)
+{
+	if(!initialized)
+		return;
+
+	// ack the reception bell before draining so we can't miss a message
+	write32(HW_IPC_PPCCTRL, IPC_CTRL_RECV | ctrl_irqmask);
+	ipc_drain();
+}
+
 ipc_request *ipc_receive(void)
 {
-	while(peek_outtail() == out_head);
-	sync_before_read((void*)&out_queue[out_head], 32);
-	req_recv = out_queue[out_head];
-	out_head = (out_head+1)&(out_size-1);
-	poke_outhead(out_head);
+	u32 cookie;
+
+	if(!irq_enabled()) {
+		// IRQ context or IRQs not set up: nobody else drains out_queue
+		while(cq_head == cq_tail) {
+			while(peek_outtail() == out_head);
+			ipc_drain();
+		}
+	} else {
+		// doze until the IPC IRQ fills the completion queue. the check
+		// runs with IRQs off, so a reply can't land between it and the
+		// doze; the decrementer wakes us every ~10ms anyway, and the
+		// drain by hand covers an IRQ that got lost
+		while(cq_head == cq_tail) {
+			cookie = irq_kill();
+			ipc_drain();
+			if(cq_head == cq_tail)
+				irq_wait(IPC_IDLE_US * TICKS_PER_USEC);
+			irq_restore(cookie);
+		}
+	}
+
+	req_recv = cq[cq_head];
+	cq_head = (cq_head+1) & (IPC_CQ_SIZE - 1);
+	ipc_stats_reply(&req_recv);
+
+	if(cq_stalled && irq_enabled()) {
+		cookie = irq_kill();
+		ipc_drain();
+		irq_restore(cookie);
+	}
 
 	return &req_recv;
 }
@@ -202,17 +477,135 @@ void ipc_process_unhandled(volatile ipc_request *rep)
 		rep->args[4], rep->args[5]);
 }
 
+int ipc_register_handler(u32 code, ipc_handler handler)
+{
+	int i, slot = -1;
+
+	for(i = 0; i < IPC_MAX_HANDLERS; i++) {
+		if(handlers[i].handler && handlers[i].code == code) {
+			slot = i;
+			break;
+		}
+		if(!handlers[i].handler && slot < 0)
+			slot = i;
+	}
+
+	if(slot < 0) {
+		printf("IPC: no free handler slot for %08x\n", code);
+		return -1;
+	}
+
+	handlers[slot].code = code;
+	handlers[slot].handler = handler;
+	return 0;
+}
+
+void ipc_unregister_handler(u32 code)
+{
+	int i;
+
+	for(i = 0; i < IPC_MAX_HANDLERS; i++)
+		if(handlers[i].handler && handlers[i].code == code)
+			handlers[i].handler = NULL;
+}
+
+// mini answers in order, so a batch only ever expects the reply to
+// reqs[done] next
+static int ipc_batch_complete(ipc_request *rep)
+{
+	ipc_batch **pb, *b;
+
+	for(pb = &pending; (b = *pb) != NULL; pb = &b->next) {
+		if(b->reqs[b->done].code != rep->code || b->reqs[b->done].tag != rep->tag)
+			continue;
+
+		memcpy(b->reqs[b->done].args, rep->args, sizeof(rep->args));
+		if(++b->done == b->count)
+			*pb = b->next;
+		return 1;
+	}
+
+	return 0;
+}
+
+// hand a reply nobody is waiting for to its batch or handler, or keep it
+// around in the stash until ipc_receive_tagged asks for it
+static void ipc_dispatch(ipc_request *rep)
+{
+	ipc_request copy;
+	int i;
+
+	if(rep->tag != 0 && ipc_batch_complete(rep))
+		return;
+
+	for(i = 0; i < IPC_MAX_HANDLERS; i++) {
+		if(handlers[i].handler && handlers[i].code == rep->code) {
+			// the handler may talk IPC itself, which clobbers req_recv
+			copy = *rep;
+			handlers[i].handler(&copy);
+			return;
+		}
+	}
+
+	// untagged messages never have a waiter
+	if(rep->tag == 0) {
+		ipc_process_unhandled(rep);
+		return;
+	}
+
+	for(i = 0; i < IPC_STASH_SIZE; i++) {
+		if(!stash_used[i]) {
+			stash[i] = *rep;
+			stash_used[i] = 1;
+			return;
+		}
+	}
+
+	// every stashed reply belongs to a waiter further up the stack than
+	// the one spinning now, so none of them can be taken before this one
+	// is stored. dropping it would leave its waiter spinning forever.
+	printf("IPC: reply stash full, can't keep %08x tag %08x\n", rep->code, rep->tag);
+	for(i = 0; i < IPC_STASH_SIZE; i++)
+		ipc_process_unhandled(&stash[i]);
+	for(;;);
+}
+
+static int ipc_unstash(u32 code, u32 tag)
+{
+	int i;
+
+	for(i = 0; i < IPC_STASH_SIZE; i++) {
+		if(stash_used[i] && stash[i].code == code && stash[i].tag == tag) {
+			req_recv = stash[i];
+			stash_used[i] = 0;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 ipc_request *ipc_receive_tagged(u32 code, u32 tag)
 {
 	ipc_request *rep;
+
+	if(ipc_unstash(code, tag))
+		return &req_recv;
+
 	rep = ipc_receive();
 	while(rep->code != code || rep->tag != tag) {
-		ipc_process_unhandled(rep);
+		ipc_dispatch(rep);
 		rep = ipc_receive();
 	}
 	return rep;
 }
 
+void ipc_poll(void)
+{
+	while(cq_head != cq_tail || peek_outtail() != out_head)
+		ipc_dispatch(ipc_receive());
+}
+
 ipc_request *ipc_exchange(u32 code, u32 num_args, ...)
 {
 	va_list ap;
@@ -232,3 +625,126 @@ ipc_request *ipc_exchange(u32 code, u32 num_args, ...)
 	return rep;
 }
 
+void ipc_exchange_batch(ipc_request *reqs, u32 count)
+{
+	ipc_request *rep;
+	u32 window = in_size / 2 > IPC_WINDOW_MAX ? IPC_WINDOW_MAX : in_size / 2;
+	u32 posted = 0;
+	u32 done = 0;
+	u32 i, n;
+
+	// keep at most half of in_queue outstanding so mini never blocks on a
+	// full out_queue while we are still waiting for room in in_queue
+	while(done < count) {
+		if(posted < count && posted - done <= window / 2) {
+			n = window - (posted - done);
+			if(n > count - posted)
+				n = count - posted;
+			for(i = posted; i < posted + n; i++)
+				reqs[i].tag = cur_tag++;
+			ipc_post_batch(&reqs[posted], n);
+			posted += n;
+		}
+
+		rep = ipc_receive_tagged(reqs[done].code, reqs[done].tag);
+		memcpy(reqs[done].args, rep->args, sizeof(rep->args));
+		done++;
+	}
+}
+
+void ipc_batch_init(ipc_batch *b)
+{
+	ipc_batch *p;
+
+	// reusing a batch that still has replies due: collect them first
+	for(p = pending; p; p = p->next)
+		if(p == b) {
+			ipc_batch_wait(b, b->count - 1);
+			break;
+		}
+
+	b->count = 0;
+	b->done = 0;
+}
+
+ipc_request *ipc_batch_add(ipc_batch *b, u32 code)
+{
+	ipc_request *req;
+
+	// full; the caller decides whether to submit and start over
+	if(b->count >= IPC_BATCH_MAX)
+		return NULL;
+
+	req = &b->reqs[b->count++];
+	memset(req, 0, sizeof(*req));
+	req->code = code;
+	return req;
+}
+
+void ipc_batch_submit(ipc_batch *b)
+{
+	u32 i;
+
+	for(i = 0; i < b->count; i++)
+		b->reqs[i].tag = cur_tag++;
+	b->done = 0;
+	if(b->count == 0)
+		return;
+
+	b->next = pending;
+	pending = b;
+	ipc_post_batch(b->reqs, b->count);
+}
+
+ipc_request *ipc_batch_wait(ipc_batch *b, u32 idx)
+{
+	// ipc_dispatch fills in b as its replies come by
+	while(b->done <= idx && b->done < b->count)
+		ipc_dispatch(ipc_receive());
+
+	return &b->reqs[idx];
+}
+
+void ipc_stats_get(struct ipc_stats *out)
+{
+	out->posts = stats.posts;
+	out->doorbells = stats.doorbells;
+	out->stalls = stats.stalls;
+	out->stall_us = stats.stall_ticks / TICKS_PER_USEC;
+	out->untracked = stats.untracked;
+	out->codes = stats.codes;
+	out->num_codes = IPC_STATS_CODES;
+}
+
+void ipc_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void ipc_stats_dump(int (*print)(const char *fmt, ...))
+{
+	struct ipc_code_stats *cs;
+	int i, j;
+
+	print("IPC: %u posts, %u doorbells, %u queue-full stalls (%u us)\n",
+		stats.posts, stats.doorbells, stats.stalls,
+		(u32)(stats.stall_ticks / TICKS_PER_USEC));
+
+	for(i = 0; i < IPC_STATS_CODES; i++) {
+		cs = &stats.codes[i];
+		if(cs->posts == 0)
+			continue;
+
+		print("IPC: %08x: %u posts, %u replies, avg %u us, max %u us\n",
+			cs->code, cs->posts, cs->replies,
+			cs->replies ? (u32)(cs->total_us / cs->replies) : 0, cs->max_us);
+		for(j = 0; j < IPC_STATS_BUCKETS; j++) {
+			if(cs->hist[j] == 0)
+				continue;
+			print("IPC: %08x:   < %7u us: %u\n", cs->code, 1 << j, cs->hist[j]);
+		}
+	}
+
+	if(stats.untracked)
+		print("IPC: %u posts for codes beyond the stats table\n", stats.untracked);
+}
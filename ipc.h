@@ -85,19 +85,73 @@ typedef struct {
 	u32 args[6];
 } ipc_request;
 
+typedef void (*ipc_handler)(ipc_request *req);
+
+// a group of requests posted with one doorbell whose replies are collected
+// later, so the caller can work while mini serves them. replies are copied
+// into reqs as they arrive, whoever happens to be waiting for IPC then.
+#define IPC_BATCH_MAX	16
+
+typedef struct ipc_batch {
+	ipc_request reqs[IPC_BATCH_MAX];
+	u32 count;
+	u32 done;
+	struct ipc_batch *next;	// on the pending list while replies are due
+} ipc_batch;
+
+// latency histogram buckets: bucket n counts replies that took < 2^n us
+#define IPC_STATS_BUCKETS	24
+
+struct ipc_code_stats {
+	u32 code;
+	u32 posts;
+	u32 replies;
+	u64 total_us;
+	u32 max_us;
+	u32 hist[IPC_STATS_BUCKETS];
+};
+
+struct ipc_stats {
+	u32 posts;
+	u32 doorbells;
+	u32 stalls;
+	u32 stall_us;
+	u32 untracked;
+	const struct ipc_code_stats *codes;
+	u32 num_codes;
+};
+
 extern void *mem2_boundary;
 
 int ipc_initialize(void);
 void ipc_shutdown(void);
 
 void ipc_post(u32 code, u32 tag, u32 num_args, ...);
+void ipc_post_batch(const ipc_request *reqs, u32 count);
 
 void ipc_flush(void);
 
+void ipc_irq(void);
+
 ipc_request *ipc_receive(void);
 ipc_request *ipc_receive_tagged(u32 code, u32 tag);
+void ipc_process_unhandled(volatile ipc_request *rep);
+
+int ipc_register_handler(u32 code, ipc_handler handler);
+void ipc_unregister_handler(u32 code);
+void ipc_poll(void);
+
+void ipc_stats_get(struct ipc_stats *out);
+void ipc_stats_reset(void);
+void ipc_stats_dump(int (*print)(const char *fmt, ...));
 
 ipc_request *ipc_exchange(u32 code, u32 num_args, ...);
+void ipc_exchange_batch(ipc_request *reqs, u32 count);
+
+void ipc_batch_init(ipc_batch *b);
+ipc_request *ipc_batch_add(ipc_batch *b, u32 code);
+void ipc_batch_submit(ipc_batch *b);
+ipc_request *ipc_batch_wait(ipc_batch *b, u32 idx);
 
 static inline void ipc_sys_write32(u32 addr, u32 x)
 {
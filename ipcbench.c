@@ -0,0 +1,97 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	IPC throughput benchmark
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "ipc.h"
+#include "ipcbench.h"
+#include "string.h"
+
+#define BENCH_MSGS		1024
+#define BENCH_BATCH_MAX	32
+
+// outstanding pings on the single post path, so the replies never back
+// up while we are still posting
+#define BENCH_WINDOW	8
+
+// tags well away from the ones ipc_exchange hands out
+#define BENCH_TAG		0xbe000000
+
+static ipc_request reqs[BENCH_BATCH_MAX];
+
+static u32 msgs_per_sec(u32 msgs, u32 us)
+{
+	if (us == 0)
+		return 0;
+	return (u64)msgs * 1000000 / us;
+}
+
+// one ipc_post (and so one doorbell) per message
+static u32 bench_post(u32 batch)
+{
+	u32 i, n, done, tag = BENCH_TAG;
+	u64 start = mftb();
+
+	for (n = 0; n < BENCH_MSGS; n += batch) {
+		done = 0;
+		for (i = 0; i < batch; i++) {
+			ipc_post(IPC_SYS_PING, tag + i, 0);
+			if (i - done >= BENCH_WINDOW)
+				ipc_receive_tagged(IPC_SYS_PING, tag + done++);
+		}
+		while (done < batch)
+			ipc_receive_tagged(IPC_SYS_PING, tag + done++);
+		tag += batch;
+	}
+
+	return (mftb() - start) / TICKS_PER_USEC;
+}
+
+// the same pings through ipc_exchange_batch, one doorbell per batch
+static u32 bench_batch(u32 batch)
+{
+	u32 i, n;
+	u64 start = mftb();
+
+	for (n = 0; n < BENCH_MSGS; n += batch) {
+		memset(reqs, 0, batch * sizeof(reqs[0]));
+		for (i = 0; i < batch; i++)
+			reqs[i].code = IPC_SYS_PING;
+		ipc_exchange_batch(reqs, batch);
+	}
+
+	return (mftb() - start) / TICKS_PER_USEC;
+}
+
+void ipc_bench(void)
+{
+	struct ipc_stats st;
+	u32 batch, post_us, post_bells, batch_us, batch_bells;
+
+	printf("ipc bench: %u pings per run\n", BENCH_MSGS);
+
+	for (batch = 1; batch <= BENCH_BATCH_MAX; batch <<= 1) {
+		ipc_stats_reset();
+		post_us = bench_post(batch);
+		ipc_stats_get(&st);
+		post_bells = st.doorbells;
+
+		ipc_stats_reset();
+		batch_us = bench_batch(batch);
+		ipc_stats_get(&st);
+		batch_bells = st.doorbells;
+
+		printf("ipc bench: batch %2u: post %7u msg/s (%4u doorbells), "
+			"batch %7u msg/s (%4u doorbells)\n", batch,
+			msgs_per_sec(BENCH_MSGS, post_us), post_bells,
+			msgs_per_sec(BENCH_MSGS, batch_us), batch_bells);
+	}
+
+	ipc_stats_reset();
+}
@@ -0,0 +1,20 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	IPC throughput benchmark
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __IPCBENCH_H__
+#define __IPCBENCH_H__
+
+#include "types.h"
+
+/* ping mini with one ipc_post per message and with ipc_exchange_batch
+   at batch sizes 1, 2, 4, ... 32 and print messages/sec for both */
+void ipc_bench(void);
+
+#endif
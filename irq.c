@@ -20,6 +20,8 @@ void show_frame_no(void);
 
 void irq_initialize(void)
 {
+	u32 hid0;
+
 	// clear flipper-pic (processor interface)
 	write32(BW_PI_IRQMASK, 0);
 	write32(BW_PI_IRQFLAG, 0xffffffff);
@@ -42,6 +44,14 @@ void irq_initialize(void)
 	 * write32(HW_PPCIRQMASK+0x20+0x08, 0);
 	 */
 
+	// HID0[DOZE], so that MSR[POW] in irq_wait stops the core
+	__asm__ __volatile__ (
+		"mfspr %0,1008\n"
+		"oris %0,%0,0x0080\n"
+		"mtspr 1008,%0\n"
+		"isync"
+		: "=&r" (hid0));
+
 	_CPU_ISR_Enable()
 }
 
@@ -98,11 +108,10 @@ void irq_handler(void)
 			//		printf("IRQ: RESET\n");
 			write32(HW_PPCIRQFLAG, IRQF_RESET);
 		}
-		if(hw_flags & IRQF_IPC) {
+		if(hw_flags & (IRQF_IPC|IRQF_PPCIPC)) {
 			//printf("IRQ: IPC\n");
-			//not necessary here?
-			//ipc_irq();
-			write32(HW_PPCIRQFLAG, IRQF_IPC);
+			ipc_irq();
+			write32(HW_PPCIRQFLAG, hw_flags & (IRQF_IPC|IRQF_PPCIPC));
 		}
 		if(hw_flags & IRQF_AES) {
 			//		printf("IRQ: AES\n");
@@ -163,3 +172,26 @@ void irq_restore(u32 cookie) {
 	_CPU_ISR_Enable(); //wtf :/
 }
 
+// the exception code doesn't rfi back to where it hit but returns to the
+// link register, i.e. to our caller, and leaves MSR[POW] clear on the way.
+// so this has to stay a leaf without a stack frame, just like udelay.
+// setting POW and EE with one mtmsr means an IRQ that came in while they
+// were off wakes us right away instead of being slept through.
+void irq_wait(u32 ticks)
+{
+	u32 msr;
+
+	__asm__ __volatile__ (
+		"mtdec %1\n"
+		"mfmsr %0\n"
+		"oris %0,%0,0x0004\n"
+		"ori %0,%0,0x8000\n"
+		"sync\n"
+		"mtmsr %0\n"
+		"isync\n"
+		// only reached if the core didn't doze
+		"rlwinm %0,%0,0,14,12\n"
+		"mtmsr %0\n"
+		"isync"
+		: "=&r" (msr) : "r" (ticks));
+}
@@ -38,12 +38,13 @@ Copyright (C) 2009		Sebastian Falbesoner <sebastian.falbesoner@gmail.com>
 #define IRQF_GPIO1	(1<<IRQ_GPIO1)
 #define IRQF_RESET	(1<<IRQ_RESET)
 #define IRQF_IPC	(1<<IRQ_IPC)
+#define IRQF_PPCIPC	(1<<IRQ_PPCIPC)
 #define IRQF_OHCI0 	(1<<IRQ_OHCI0)
 #define IRQF_OHCI1 	(1<<IRQ_OHCI1)
 
 #define IRQF_ALL	( \
 	IRQF_TIMER|IRQF_NAND|IRQF_GPIO1B|IRQF_GPIO1| \
-	IRQF_RESET|IRQF_IPC|IRQF_AES|IRQF_SDHC| \
+	IRQF_RESET|IRQF_IPC|IRQF_PPCIPC|IRQF_AES|IRQF_SDHC| \
 	IRQF_OHCI0|IRQF_OHCI1 \
 	)
 
@@ -119,13 +120,17 @@ void irq_hw_disable(u32 irq);
 u32 irq_kill(void);
 void irq_restore(u32 cookie);
 
-/* TODO: port to ppc 
-static inline void irq_wait(void)
+/* nonzero if external interrupts are enabled (MSR[EE]) */
+static inline u32 irq_enabled(void)
 {
-	u32 data = 0;
-	__asm__ volatile ( "mcr\tp15, 0, %0, c7, c0, 4" : : "r" (data) );
+	u32 msr;
+	__asm__ __volatile__ ("mfmsr %0" : "=r" (msr));
+	return msr & 0x8000;
 }
-*/
+
+/* doze until the next interrupt, or until the decrementer fires after
+   ticks timebase ticks. call with IRQs off; returns with them on */
+void irq_wait(u32 ticks);
 
 #endif
 
@@ -138,6 +143,14 @@ static inline u32 irq_kill(void) {
 static inline void irq_restore(u32 cookie) {
 	(void)cookie;
 }
+
+static inline u32 irq_enabled(void) {
+	return 0;
+}
+
+static inline void irq_wait(u32 ticks) {
+	(void)ticks;
+}
 #endif
 
 
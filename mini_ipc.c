@@ -62,15 +62,27 @@ void getseeprom(seeprom_t *seeprom)
 	ipc_exchange(IPC_KEYS_GETEEP, 1, virt_to_phys(seeprom));
 }
 
+// key last loaded into the AES engine, so repeated set_key calls with the
+// same key (e.g. the NAND key for every cluster) cost nothing
+static u32 aes_key[4];
+static int aes_key_valid = 0;
+
 void aes_reset(void)
 {
+	aes_key_valid = 0;
 	ipc_exchange(IPC_AES_RESET, 0);
 }
 
 void aes_set_key(u8 *key)
 {
 	u32 *keyptr = (u32 *)key;
+
+	if (aes_key_valid && memcmp(aes_key, key, sizeof(aes_key)) == 0)
+		return;
+
 	ipc_exchange(IPC_AES_SETKEY, 4, keyptr[0], keyptr[1], keyptr[2], keyptr[3]);
+	memcpy(aes_key, key, sizeof(aes_key));
+	aes_key_valid = 1;
 }
 
 void aes_set_iv(u8 *iv)
@@ -86,6 +98,35 @@ void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 	sync_before_read(dst, (blocks+1)*16);
 }
 
+// the async builders return -1 and queue nothing if the batch is full;
+// the caller can submit it, start a new one and try again
+int aes_set_iv_async(ipc_batch *b, u8 *iv)
+{
+	u32 *ivptr = (u32 *)iv;
+	ipc_request *req = ipc_batch_add(b, IPC_AES_SETIV);
+
+	if (!req)
+		return -1;
+	memcpy(req->args, ivptr, 16);
+	return 0;
+}
+
+// the caller has to sync_before_read(dst, ...) once the reply is in
+int aes_decrypt_async(ipc_batch *b, u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
+{
+	ipc_request *req;
+
+	req = ipc_batch_add(b, IPC_AES_DECRYPT);
+	if (!req)
+		return -1;
+	sync_after_write(src, (blocks+1)*16);
+	req->args[0] = virt_to_phys(src);
+	req->args[1] = virt_to_phys(dst);
+	req->args[2] = blocks;
+	req->args[3] = keep_iv;
+	return 0;
+}
+
 void nand_reset(void)
 {
 	ipc_exchange(IPC_NAND_RESET, 0);
@@ -122,6 +163,81 @@ int nand_read(u32 pageno, void *data, void *ecc)
 		(!ecc ? (u32)-1 : virt_to_phys(ecc)))->args[0];
 }
 
+// pages per ipc_exchange_batch() call; mini serves them back to back
+#define NAND_BATCH	32
+
+int nand_read_pages_stride(u32 pageno, u32 stride, u32 count, void *data, void *ecc)
+{
+	ipc_request reqs[NAND_BATCH];
+	u8 *d = data, *e = ecc;
+	u32 i, n;
+	int ret = NAND_ECC_OK;
+
+	if (data)
+		sync_before_read(data, count * 0x800);
+	if (ecc)
+		sync_before_read(ecc, count * 0x40);
+
+	while (count) {
+		n = count > NAND_BATCH ? NAND_BATCH : count;
+
+		// args[3..5] are posted too, don't hand mini stack garbage
+		memset(reqs, 0, n * sizeof(reqs[0]));
+		for (i = 0; i < n; i++) {
+			reqs[i].code = IPC_NAND_READ;
+			reqs[i].args[0] = pageno + i * stride;
+			reqs[i].args[1] = !d ? (u32)-1 : virt_to_phys(d + i * 0x800);
+			reqs[i].args[2] = !e ? (u32)-1 : virt_to_phys(e + i * 0x40);
+		}
+
+		ipc_exchange_batch(reqs, n);
+
+		for (i = 0; i < n; i++) {
+			// uncorrectable is sticky, otherwise report corrections
+			if (ret != NAND_ECC_UNCORRECTABLE && (int)reqs[i].args[0] != NAND_ECC_OK)
+				ret = reqs[i].args[0];
+		}
+
+		pageno += n * stride;
+		count -= n;
+		if (d)
+			d += n * 0x800;
+		if (e)
+			e += n * 0x40;
+	}
+
+	return ret;
+}
+
+int nand_read_pages(u32 pageno, u32 count, void *data, void *ecc)
+{
+	return nand_read_pages_stride(pageno, 1, count, data, ecc);
+}
+
+int nand_read_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc)
+{
+	ipc_request *req;
+	u8 *d = data, *e = ecc;
+	u32 i;
+
+	// all pages or none, so a retry doesn't read any of them twice
+	if (count > IPC_BATCH_MAX - b->count)
+		return -1;
+
+	if (data)
+		sync_before_read(data, count * 0x800);
+	if (ecc)
+		sync_before_read(ecc, count * 0x40);
+
+	for (i = 0; i < count; i++) {
+		req = ipc_batch_add(b, IPC_NAND_READ);
+		req->args[0] = pageno + i;
+		req->args[1] = !d ? (u32)-1 : virt_to_phys(d + i * 0x800);
+		req->args[2] = !e ? (u32)-1 : virt_to_phys(e + i * 0x40);
+	}
+	return 0;
+}
+
 void nand_write(u32 pageno, void *data, void *ecc)
 {
 	if (data)
@@ -133,6 +249,30 @@ void nand_write(u32 pageno, void *data, void *ecc)
 		(!ecc ? (u32)-1 : virt_to_phys(ecc)));
 }
 
+int nand_write_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc)
+{
+	ipc_request *req;
+	u8 *d = data, *e = ecc;
+	u32 i;
+
+	// all pages or none, so a retry doesn't program any of them twice
+	if (count > IPC_BATCH_MAX - b->count)
+		return -1;
+
+	if (data)
+		sync_after_write(data, count * 0x800);
+	if (ecc)
+		sync_after_write(ecc, count * 0x40);
+
+	for (i = 0; i < count; i++) {
+		req = ipc_batch_add(b, IPC_NAND_WRITE);
+		req->args[0] = pageno + i;
+		req->args[1] = !d ? (u32)-1 : virt_to_phys(d + i * 0x800);
+		req->args[2] = !e ? (u32)-1 : virt_to_phys(e + i * 0x40);
+	}
+	return 0;
+}
+
 void nand_erase(u32 pageno)
 {
 	ipc_exchange(IPC_NAND_ERASE, 1, pageno);
@@ -168,6 +308,22 @@ int sd_read(u32 start_block, u32 blk_cnt, void *buffer)
 	return retval;
 }
 
+// the reply's args[0] is the sd_read status; the buffer must not be touched
+// until it is in
+int sd_read_async(ipc_batch *b, u32 start_block, u32 blk_cnt, void *buffer)
+{
+	ipc_request *req;
+
+	req = ipc_batch_add(b, IPC_SDMMC_READ);
+	if (!req)
+		return -1;
+	sync_before_read(buffer, blk_cnt * 512);
+	req->args[0] = start_block;
+	req->args[1] = blk_cnt;
+	req->args[2] = virt_to_phys(buffer);
+	return 0;
+}
+
 int sd_write(u32 start_block, u32 blk_cnt, const void *buffer)
 {
 	int retval;
@@ -177,6 +333,21 @@ int sd_write(u32 start_block, u32 blk_cnt, const void *buffer)
 	return retval;
 }
 
+// the buffer must stay untouched until the reply is in
+int sd_write_async(ipc_batch *b, u32 start_block, u32 blk_cnt, const void *buffer)
+{
+	ipc_request *req;
+
+	req = ipc_batch_add(b, IPC_SDMMC_WRITE);
+	if (!req)
+		return -1;
+	sync_after_write(buffer, blk_cnt * 512);
+	req->args[0] = start_block;
+	req->args[1] = blk_cnt;
+	req->args[2] = virt_to_phys(buffer);
+	return 0;
+}
+
 u32 sd_getsize(void)
 {
 	return ipc_exchange(IPC_SDMMC_SIZE, 0)->args[0];
@@ -14,6 +14,8 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #ifndef __MINI_IPC_H__
 #define __MINI_IPC_H__
 
+#include "ipc.h"
+
 #define SDHC_ENOCARD    -0x1001
 #define SDHC_ESTRANGE   -0x1002
 #define SDHC_EOVERFLOW  -0x1003
@@ -35,6 +37,8 @@ int sd_mount(void);
 int sd_select(void);
 int sd_read(u32 start_block, u32 blk_cnt, void *buffer);
 int sd_write(u32 start_block, u32 blk_cnt, const void *buffer);
+int sd_read_async(ipc_batch *b, u32 start_block, u32 blk_cnt, void *buffer);
+int sd_write_async(ipc_batch *b, u32 start_block, u32 blk_cnt, const void *buffer);
 u32 sd_getsize(void);
 
 int ipc_powerpc_boot(const void *addr, u32 len);
@@ -138,12 +142,18 @@ void aes_reset(void);
 void aes_set_key(u8 *key);
 void aes_set_iv(u8 *iv);
 void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
+int aes_set_iv_async(ipc_batch *b, u8 *iv);
+int aes_decrypt_async(ipc_batch *b, u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
 
 void nand_reset(void);
 u32 nand_getid(void);
 u8 nand_status(void);
 int nand_read(u32 pageno, void *data, void *ecc);
+int nand_read_pages(u32 pageno, u32 count, void *data, void *ecc);
+int nand_read_pages_stride(u32 pageno, u32 stride, u32 count, void *data, void *ecc);
+int nand_read_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc);
 void nand_write(u32 pageno, void *data, void *ecc);
+int nand_write_pages_async(ipc_batch *b, u32 pageno, u32 count, void *data, void *ecc);
 void nand_erase(u32 pageno);
 
 #endif
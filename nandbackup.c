@@ -0,0 +1,360 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	NAND backup to SD
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "ipc.h"
+#include "mini_ipc.h"
+#include "nandbackup.h"
+#include "fat.h"
+#include "sha1.h"
+#include "string.h"
+
+// one IPC batch of page reads is in flight while the previous one is
+// hashed; full chunks go to SD with a single f_write
+#define	BATCH_PAGES	IPC_BATCH_MAX
+#define	CHUNK_PAGES	(BATCH_PAGES * 4)
+
+#if CHUNK_PAGES < NAND_BLOCK_PAGES
+#error "a ring chunk has to hold a whole NAND block for nand_restore"
+#endif
+
+static u8 ring[2][CHUNK_PAGES * NAND_RAW_PAGE_SIZE] MEM2_BSS ALIGNED(64);
+static ipc_batch batch[2];
+static FIL fil;
+
+static u32 ticks_to_us(u64 ticks)
+{
+	return ticks / TICKS_PER_USEC;
+}
+
+// queue the reads of up to BATCH_PAGES pages, data and spare interleaved
+static u32 post_pages(ipc_batch *b, u32 page, u32 left, u8 *dst)
+{
+	u32 i, n = left > BATCH_PAGES ? BATCH_PAGES : left;
+
+	ipc_batch_init(b);
+	for (i = 0; i < n; i++)
+		nand_read_pages_async(b, page + i, 1,
+			dst + i * NAND_RAW_PAGE_SIZE,
+			dst + i * NAND_RAW_PAGE_SIZE + NAND_PAGE_SIZE);
+	if (n)
+		ipc_batch_submit(b);
+
+	return n;
+}
+
+static void wait_pages(ipc_batch *b, struct nand_backup_stats *stats)
+{
+	u64 t = mftb();
+	u32 i;
+
+	if (b->count == 0 || b->done == b->count)
+		return;
+
+	ipc_batch_wait(b, b->count - 1);
+	stats->read_wait_us += ticks_to_us(mftb() - t);
+
+	for (i = 0; i < b->count; i++) {
+		if ((int)b->reqs[i].args[0] == NAND_ECC_UNCORRECTABLE)
+			stats->ecc_failed++;
+		else if ((int)b->reqs[i].args[0] == NAND_ECC_CORRECTED)
+			stats->ecc_corrected++;
+	}
+}
+
+s32 nand_backup(const char *path, u32 first, u32 count, u8 *sha1,
+		struct nand_backup_stats *stats)
+{
+	struct nand_backup_stats local;
+	SHA1_CTX ctx;
+	u8 digest[20];
+	u32 n, nn, fill, nfill, chunk, nchunk, cur, bw;
+	u64 start, t;
+	FRESULT res;
+
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+
+	if (first >= NAND_PAGES || count > NAND_PAGES - first)
+		return -1;
+
+	res = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS);
+	if (res != FR_OK) {
+		printf("NAND backup: can't create %s (%d)\n", path, res);
+		return -1;
+	}
+
+	// reserve the whole image up front so the writes below stream into
+	// one contiguous run; a fragmented card still works, just slower
+	if (f_expand(&fil, count * NAND_RAW_PAGE_SIZE, 1) != FR_OK)
+		printf("NAND backup: no contiguous space for %s\n", path);
+
+	start = mftb();
+	SHA1Init(&ctx);
+
+	chunk = 0;
+	fill = 0;
+	cur = 0;
+	n = post_pages(&batch[cur], first, count, ring[chunk]);
+
+	while (n) {
+		// where the batch after this one lands
+		nchunk = chunk;
+		nfill = fill + n;
+		if (nfill == CHUNK_PAGES) {
+			nchunk ^= 1;
+			nfill = 0;
+		}
+
+		// keep mini busy with the next batch while we hash this one
+		nn = post_pages(&batch[cur ^ 1], first + n, count - n,
+				ring[nchunk] + nfill * NAND_RAW_PAGE_SIZE);
+
+		wait_pages(&batch[cur], stats);
+
+		t = mftb();
+		SHA1Update(&ctx, ring[chunk] + fill * NAND_RAW_PAGE_SIZE,
+			n * NAND_RAW_PAGE_SIZE);
+		stats->hash_us += ticks_to_us(mftb() - t);
+
+		fill += n;
+		first += n;
+		count -= n;
+		stats->pages += n;
+
+		if (fill == CHUNK_PAGES || count == 0) {
+			// the SD write queues behind the outstanding NAND reads,
+			// collect those first so their replies aren't parked
+			wait_pages(&batch[cur ^ 1], stats);
+
+			t = mftb();
+			res = f_write(&fil, ring[chunk], fill * NAND_RAW_PAGE_SIZE, &bw);
+			stats->write_us += ticks_to_us(mftb() - t);
+			if (res != FR_OK || bw != fill * NAND_RAW_PAGE_SIZE) {
+				printf("NAND backup: write failed at page %u (%d)\n",
+					first - fill, res);
+				wait_pages(&batch[cur ^ 1], stats);
+				fat_abort(&fil, path);
+				return -1;
+			}
+
+			chunk ^= 1;
+			fill = 0;
+		}
+
+		cur ^= 1;
+		n = nn;
+	}
+
+	res = f_close(&fil);
+	SHA1Final(digest, &ctx);
+	if (sha1)
+		memcpy(sha1, digest, sizeof(digest));
+
+	stats->total_us = ticks_to_us(mftb() - start);
+
+	return res == FR_OK ? 0 : -1;
+}
+
+static u32 kb_per_sec(u32 pages, u32 us)
+{
+	if (us == 0)
+		return 0;
+	return (u64)pages * NAND_RAW_PAGE_SIZE * 1000000 / 1024 / us;
+}
+
+void nand_backup_print_stats(const struct nand_backup_stats *stats)
+{
+	printf("NAND backup: %u pages in %u ms (%u KB/s), %u corrected, %u bad\n",
+		stats->pages, stats->total_us / 1000,
+		kb_per_sec(stats->pages, stats->total_us),
+		stats->ecc_corrected, stats->ecc_failed);
+	printf("NAND backup: read wait %u ms, hash %u ms (%u KB/s), write %u ms (%u KB/s)\n",
+		stats->read_wait_us / 1000,
+		stats->hash_us / 1000, kb_per_sec(stats->pages, stats->hash_us),
+		stats->write_us / 1000, kb_per_sec(stats->pages, stats->write_us));
+}
+
+// read one whole block of flash, data and spare interleaved like the image
+static void read_block(u32 page, u8 *dst)
+{
+	u32 i, n;
+
+	for (i = 0; i < NAND_BLOCK_PAGES; i += BATCH_PAGES) {
+		ipc_batch_init(&batch[0]);
+		for (n = 0; n < BATCH_PAGES; n++)
+			nand_read_pages_async(&batch[0], page + i + n, 1,
+				dst + (i + n) * NAND_RAW_PAGE_SIZE,
+				dst + (i + n) * NAND_RAW_PAGE_SIZE + NAND_PAGE_SIZE);
+		ipc_batch_submit(&batch[0]);
+		ipc_batch_wait(&batch[0], batch[0].count - 1);
+	}
+}
+
+static int page_differs(const u8 *a, const u8 *b)
+{
+	// the spare holds the ECC of the data, so compare that first
+	return memcmp(a + NAND_PAGE_SIZE, b + NAND_PAGE_SIZE, NAND_SPARE_SIZE) ||
+		memcmp(a, b, NAND_PAGE_SIZE);
+}
+
+// the bad block marker is the first spare byte of a block's first or
+// second page; erasing the block would wipe it
+static int block_bad(const u8 *block)
+{
+	return block[NAND_PAGE_SIZE] != 0xff ||
+		block[NAND_RAW_PAGE_SIZE + NAND_PAGE_SIZE] != 0xff;
+}
+
+static int page_erased(const u8 *p)
+{
+	u32 i;
+
+	for (i = 0; i < NAND_RAW_PAGE_SIZE; i++)
+		if (p[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+// erase the block and program every page of the image that isn't blank
+static u32 program_block(u32 page, u8 *src)
+{
+	u32 i, written = 0;
+
+	nand_erase(page);
+
+	ipc_batch_init(&batch[0]);
+	for (i = 0; i < NAND_BLOCK_PAGES; i++) {
+		if (page_erased(src + i * NAND_RAW_PAGE_SIZE))
+			continue;
+
+		// send off a full batch and queue the page in a new one
+		while (nand_write_pages_async(&batch[0], page + i, 1,
+				src + i * NAND_RAW_PAGE_SIZE,
+				src + i * NAND_RAW_PAGE_SIZE + NAND_PAGE_SIZE)) {
+			ipc_batch_submit(&batch[0]);
+			ipc_batch_wait(&batch[0], batch[0].count - 1);
+			ipc_batch_init(&batch[0]);
+		}
+		written++;
+	}
+	if (batch[0].count) {
+		ipc_batch_submit(&batch[0]);
+		ipc_batch_wait(&batch[0], batch[0].count - 1);
+	}
+
+	return written;
+}
+
+s32 nand_restore(const char *path, u32 first, u32 count,
+		struct nand_restore_stats *stats, nand_restore_progress progress)
+{
+	struct nand_restore_stats local;
+	u8 *image = ring[0], *flash = ring[1];
+	u32 block, page, i, br;
+	u64 start, t;
+	FRESULT res;
+	s32 ret = 0;
+
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+
+	if (first >= NAND_PAGES / NAND_BLOCK_PAGES ||
+	    count > NAND_PAGES / NAND_BLOCK_PAGES - first)
+		return -1;
+
+	res = f_open(&fil, path, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK) {
+		printf("NAND restore: can't open %s (%d)\n", path, res);
+		return -1;
+	}
+
+	res = f_lseek(&fil, first * NAND_BLOCK_PAGES * NAND_RAW_PAGE_SIZE);
+	if (res != FR_OK) {
+		f_close(&fil);
+		return -1;
+	}
+
+	start = mftb();
+
+	for (block = first; block < first + count; block++) {
+		page = block * NAND_BLOCK_PAGES;
+
+		t = mftb();
+		res = f_read(&fil, image, NAND_BLOCK_PAGES * NAND_RAW_PAGE_SIZE, &br);
+		stats->read_us += ticks_to_us(mftb() - t);
+		if (res != FR_OK || br != NAND_BLOCK_PAGES * NAND_RAW_PAGE_SIZE) {
+			printf("NAND restore: image too short at block %u (%d)\n",
+				block, res);
+			ret = -1;
+			break;
+		}
+
+		t = mftb();
+		read_block(page, flash);
+		for (i = 0; i < NAND_BLOCK_PAGES; i++)
+			if (page_differs(image + i * NAND_RAW_PAGE_SIZE,
+					 flash + i * NAND_RAW_PAGE_SIZE))
+				break;
+		stats->compare_us += ticks_to_us(mftb() - t);
+
+		stats->blocks++;
+		if (block_bad(flash)) {
+			printf("NAND restore: block %u is marked bad, skipping\n", block);
+			stats->blocks_bad++;
+		} else if (i == NAND_BLOCK_PAGES) {
+			stats->blocks_skipped++;
+		} else {
+			t = mftb();
+			stats->pages_written += program_block(page, image);
+			stats->blocks_written++;
+
+			read_block(page, flash);
+			for (i = 0; i < NAND_BLOCK_PAGES; i++)
+				if (page_differs(image + i * NAND_RAW_PAGE_SIZE,
+						 flash + i * NAND_RAW_PAGE_SIZE))
+					break;
+			// mini doesn't report erase or program status, the read
+			// back is the only check; a block failing it may be
+			// going bad, so don't retry, report it
+			if (i != NAND_BLOCK_PAGES) {
+				printf("NAND restore: block %u failed to erase or program, verify failed at page %u\n",
+					block, page + i);
+				stats->verify_failed++;
+				ret = -1;
+			}
+			stats->program_us += ticks_to_us(mftb() - t);
+		}
+
+		if (progress)
+			progress(block - first + 1, count, stats);
+	}
+
+	f_close(&fil);
+	stats->total_us = ticks_to_us(mftb() - start);
+
+	return ret;
+}
+
+void nand_restore_print_stats(const struct nand_restore_stats *stats)
+{
+	u32 pages = stats->blocks * NAND_BLOCK_PAGES;
+
+	printf("NAND restore: %u blocks in %u ms (%u KB/s), %u unchanged, %u written (%u pages), %u bad, %u failed verify\n",
+		stats->blocks, stats->total_us / 1000,
+		kb_per_sec(pages, stats->total_us),
+		stats->blocks_skipped, stats->blocks_written,
+		stats->pages_written, stats->blocks_bad, stats->verify_failed);
+	printf("NAND restore: SD read %u ms, compare %u ms, program %u ms\n",
+		stats->read_us / 1000, stats->compare_us / 1000,
+		stats->program_us / 1000);
+}
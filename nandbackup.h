@@ -0,0 +1,67 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	NAND backup to SD
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __NANDBACKUP_H__
+#define __NANDBACKUP_H__
+
+#include "types.h"
+
+#define	NAND_PAGE_SIZE		0x800
+#define	NAND_SPARE_SIZE		0x40
+#define	NAND_RAW_PAGE_SIZE	(NAND_PAGE_SIZE + NAND_SPARE_SIZE)
+#define	NAND_PAGES		0x40000
+#define	NAND_BLOCK_PAGES	64
+
+struct nand_backup_stats {
+	u32 pages;
+	u32 ecc_corrected;
+	u32 ecc_failed;
+	u32 total_us;
+	u32 read_wait_us;	// time spent waiting for mini's NAND reads
+	u32 hash_us;		// time spent in the SHA engine
+	u32 write_us;		// time spent in f_write
+};
+
+/* dump count pages starting at first to path on SD, 0x840 bytes per page
+   (data followed by spare/ECC, like BootMii's nand.bin). the SHA-1 of the
+   written stream is stored in sha1 if non-NULL. */
+s32 nand_backup(const char *path, u32 first, u32 count, u8 *sha1,
+		struct nand_backup_stats *stats);
+
+void nand_backup_print_stats(const struct nand_backup_stats *stats);
+
+struct nand_restore_stats {
+	u32 blocks;
+	u32 blocks_skipped;	// identical to the image, left alone
+	u32 blocks_written;
+	u32 blocks_bad;		// marked bad on the flash, left alone
+	u32 pages_written;
+	u32 verify_failed;	// blocks that didn't read back right after programming
+	u32 total_us;
+	u32 read_us;		// image reads from SD
+	u32 compare_us;		// flash reads and compares
+	u32 program_us;		// erase, program and verify
+};
+
+/* called after every block with the number of blocks done so far */
+typedef void (*nand_restore_progress)(u32 done, u32 total,
+		const struct nand_restore_stats *stats);
+
+/* restore count blocks starting at block first from a nand.bin style
+   image on SD. blocks whose pages already match the flash, data and
+   spare, are not erased or programmed, and neither are blocks the flash
+   marks bad. fails if a block didn't verify after programming; the
+   remaining blocks are still restored. */
+s32 nand_restore(const char *path, u32 first, u32 count,
+		struct nand_restore_stats *stats, nand_restore_progress progress);
+
+void nand_restore_print_stats(const struct nand_restore_stats *stats);
+
+#endif
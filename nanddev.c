@@ -0,0 +1,97 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	NAND and AES access through mini
+
+Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "ipc.h"
+#include "mini_ipc.h"
+#include "nanddev.h"
+
+#define	CLUSTER_SIZE	0x4000
+
+static otp_t otp;
+static ipc_batch batch;
+static u32 batch_read;
+
+s32 nanddev_initialize(void)
+{
+	getotp(&otp);
+
+	nand_reset();
+	aes_reset();
+	return 0;
+}
+
+s32 nanddev_read(u32 pageno, u32 count, void *data, void *ecc)
+{
+	return nand_read_pages(pageno, count, data, ecc);
+}
+
+void nanddev_read_list(const u32 *pages, u32 count, u8 *data, u8 *ecc,
+		s32 *status)
+{
+	u32 i;
+
+	// one request per page, all of them in a single batch
+	while (count > 0) {
+		u32 n = count > IPC_BATCH_MAX ? IPC_BATCH_MAX : count;
+
+		ipc_batch_init(&batch);
+		for (i = 0; i < n; i++)
+			nand_read_pages_async(&batch, pages[i], 1,
+				data + i*0x800, ecc ? ecc + i*0x40 : NULL);
+		ipc_batch_submit(&batch);
+		ipc_batch_wait(&batch, n - 1);
+
+		for (i = 0; i < n; i++)
+			status[i] = batch.reqs[i].args[0];
+
+		pages += n;
+		data += n*0x800;
+		if (ecc)
+			ecc += n*0x40;
+		status += n;
+		count -= n;
+	}
+}
+
+void nanddev_decrypt_start(u8 *cluster, u32 next_pageno, u8 *next)
+{
+	u8 iv[16] = {0,};
+
+	// aes_set_key only talks to mini when the key actually changed
+	aes_set_key(otp.nand_key);
+
+	ipc_batch_init(&batch);
+	aes_set_iv_async(&batch, iv);
+	aes_decrypt_async(&batch, cluster, cluster, CLUSTER_SIZE / 16, 0);
+
+	batch_read = 0;
+	if (next) {
+		nand_read_pages_async(&batch, next_pageno, 8, next, NULL);
+		batch_read = 1;
+	}
+	ipc_batch_submit(&batch);
+}
+
+void nanddev_decrypt_wait(u8 *cluster)
+{
+	ipc_batch_wait(&batch, 1);
+	sync_before_read(cluster, CLUSTER_SIZE);
+}
+
+void nanddev_read_wait(void)
+{
+	if (batch_read)
+		ipc_batch_wait(&batch, batch.count - 1);
+	batch_read = 0;
+}
+
@@ -0,0 +1,47 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	NAND and AES access used by nandfs
+
+Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __NANDDEV_H__
+#define __NANDDEV_H__
+
+#include "types.h"
+
+/* nandfs only talks to the flash through these calls. nanddev.c implements
+   them on top of mini, host/nanddev_image.c on a nand.bin dump with a
+   software AES-128-CBC; the backend is picked at link time.
+
+   ECC status values are the NAND_ECC_* codes from mini_ipc.h. */
+
+/* reset NAND and AES, load the NAND key */
+s32 nanddev_initialize(void);
+
+/* read count consecutive pages; returns the worst ECC status */
+s32 nanddev_read(u32 pageno, u32 count, void *data, void *ecc);
+
+/* read one page from each of pages[], page i goes to data + i*0x800 and
+   its spare to ecc + i*0x40; status[i] receives its ECC status */
+void nanddev_read_list(const u32 *pages, u32 count, u8 *data, u8 *ecc,
+		s32 *status);
+
+/* start decrypting the 16k cluster in place (NAND key, zero IV). if next
+   is not NULL the cluster at next_pageno is read into it behind the
+   decryption. */
+void nanddev_decrypt_start(u8 *cluster, u32 next_pageno, u8 *next);
+
+/* wait for the decryption started last; the plaintext is then visible */
+void nanddev_decrypt_wait(u8 *cluster);
+
+/* wait for the read queued by nanddev_decrypt_start */
+void nanddev_read_wait(void);
+
+#endif
+
@@ -11,15 +11,24 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 */
 
 #include "bootmii_ppc.h"
-#include "ipc.h"
 #include "mini_ipc.h"
+#include "nanddev.h"
 #include "nandfs.h"
 #include "string.h"
 
 #define	PAGE_SIZE	2048
-#define NANDFS_FREE 	0xFFFE
 
-static otp_t otp;
+// SFFS is big endian on the flash, like the console. these only do
+// something in a little endian host build.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define	be16(x)	__builtin_bswap16(x)
+#define	be32(x)	__builtin_bswap32(x)
+#else
+#define	be16(x)	(x)
+#define	be32(x)	(x)
+#endif
+#define NANDFS_FREE 	0xFFFE
+#define NANDFS_MAX_FILES	6143
 
 struct _nandfs_file_node {
 	char name[NANDFS_NAME_LEN];
@@ -42,7 +51,7 @@ struct _nandfs_sffs {
 	u32 dummy;
 
 	u16 cluster_table[32768];
-	struct _nandfs_file_node files[6143];
+	struct _nandfs_file_node files[NANDFS_MAX_FILES];
 } __attribute__((packed));
 
 
@@ -51,64 +60,368 @@ union _sffs_t {
 	struct _nandfs_sffs sffs;
 };
 
-static union _sffs_t sffs __attribute__((aligned(32)));
+#define SFFS_PAGES	(sizeof(union _sffs_t) / PAGE_SIZE)
+#define SFFS_FIRST	0x7F00	// cluster of the first superblock slot
+#define SFFS_SLOTS	16
+#define SFFS_CLUSTERS	(sizeof(sffs.sffs.cluster_table) / sizeof(u16))
+
+// the superblock is only read page by page as the cluster table and FST
+// are touched, and it lives in MEM2 to keep MEM1 free
+static union _sffs_t sffs MEM2_BSS __attribute__((aligned(32)));
+static u8 sffs_loaded[SFFS_PAGES];
+static u32 sffs_page0;
 
 /*static u8 _sffs_buffer[16*8*2048] __attribute__((aligned(32)));
 static struct _nandfs_sffs *sffs = (struct _nandfs_sffs *)&_sffs_buffer;*/
-static u8 buffer[8*2048] __attribute__((aligned(32)));
+#if NANDFS_CACHE_CLUSTERS < 2
+#error "nandfs needs at least two cache slots for read-ahead"
+#endif
+
+#define CACHE_EMPTY	0
+#define CACHE_RAW	1	// read from NAND, still encrypted
+#define CACHE_PLAIN	2	// decrypted
+
+// decrypted cluster cache. the read-ahead also reads the next cluster
+// straight into a slot, so the data buffers double as pipeline buffers.
+static u8 cache_data[NANDFS_CACHE_CLUSTERS][8*2048] MEM2_BSS ALIGNED(32);
+static struct {
+	s32 cluster;
+	u32 state;
+	u32 last_use;
+} cache[NANDFS_CACHE_CLUSTERS];
+static u32 cache_clock;
+static u32 cache_hits;
+static u32 cache_prefetch_hits;
+static u32 cache_misses;
+
+// (parent, name) -> node hash index over the FST. built on the first
+// lookup after mount rather than by nandfs_initialize, which doesn't have
+// to read the whole FST; index_us is what that first lookup paid for it
+#define NANDFS_HASH_SIZE	8192
+#define NANDFS_NONE		0xffff
+
+static u16 hash_head[NANDFS_HASH_SIZE] MEM2_BSS;
+static u16 hash_next[NANDFS_MAX_FILES] MEM2_BSS;
+static u16 node_parent[NANDFS_MAX_FILES] MEM2_BSS;
+static u16 dir_queue[NANDFS_MAX_FILES] MEM2_BSS;
+static int index_ready;
+static u32 index_nodes;
+static u32 index_us;
+
+// flat cluster chains of recently seeked files, so a seek is one lookup
+// instead of a walk through cluster_table. maps are carved from one pool
+// which is simply reset when it runs out.
+#define CHAIN_POOL_SIZE		32768
+#define CHAIN_MAPS		16
+
+static u16 chain_pool[CHAIN_POOL_SIZE] MEM2_BSS;
+static u32 chain_pool_used;
+static struct {
+	u16 first;
+	u16 count;
+	u32 offset;
+} chain_maps[CHAIN_MAPS];
+
 static s32 initialized = 0;
 
-void nand_read_cluster(u32 pageno, u8 *buffer)
+// make sure the superblock bytes [p, p+len) are in memory, reading the
+// missing pages in as few batched NAND reads as possible
+static void sffs_load(const void *p, u32 len)
+{
+	u32 first = ((const u8 *)p - sffs.buffer) / PAGE_SIZE;
+	u32 last = ((const u8 *)p - sffs.buffer + len - 1) / PAGE_SIZE;
+	u32 run;
+
+	if (last >= SFFS_PAGES)
+		last = SFFS_PAGES - 1;
+
+	while (first <= last) {
+		if (sffs_loaded[first]) {
+			first++;
+			continue;
+		}
+
+		for (run = 0; first + run <= last && !sffs_loaded[first + run]; run++)
+			sffs_loaded[first + run] = 1;
+
+		nanddev_read(sffs_page0 + first, run,
+				sffs.buffer + first * PAGE_SIZE, NULL);
+		first += run;
+	}
+}
+
+static struct _nandfs_file_node *fst_node(u16 i)
+{
+	struct _nandfs_file_node *node = &sffs.sffs.files[i];
+
+	sffs_load(node, sizeof(*node));
+	return node;
+}
+
+static u16 cluster_next(u16 c)
+{
+	sffs_load(&sffs.sffs.cluster_table[c], sizeof(u16));
+	return be16(sffs.sffs.cluster_table[c]);
+}
+
+static void cache_invalidate(void)
+{
+	memset(cache, 0, sizeof(cache));
+	cache_clock = 0;
+}
+
+static int cache_find(s32 cluster)
 {
 	int i;
-	for (i = 0; i < 8; i++)
-		nand_read(pageno + i, buffer + (i * PAGE_SIZE), NULL);
+
+	for (i = 0; i < NANDFS_CACHE_CLUSTERS; i++)
+		if (cache[i].state != CACHE_EMPTY && cache[i].cluster == cluster)
+			return i;
+	return -1;
+}
+
+// least recently used slot, never the one we are currently working on
+static int cache_victim(int keep)
+{
+	int i, victim = -1;
+
+	for (i = 0; i < NANDFS_CACHE_CLUSTERS; i++) {
+		if (i == keep)
+			continue;
+		if (cache[i].state == CACHE_EMPTY)
+			return i;
+		if (victim < 0 || cache[i].last_use < cache[victim].last_use)
+			victim = i;
+	}
+	return victim;
+}
+
+static void cache_claim(int slot, s32 cluster)
+{
+	cache[slot].cluster = cluster;
+	cache[slot].state = CACHE_RAW;
+	cache[slot].last_use = ++cache_clock;
+}
+
+static void chain_invalidate(void)
+{
+	memset(chain_maps, 0, sizeof(chain_maps));
+	chain_pool_used = 0;
+}
+
+// cluster chain of the file starting at first as a flat array, built on
+// first use. returns NULL if the file is too large for the pool.
+static u16 *chain_map(u16 first, u32 size, u32 *count)
+{
+	u32 i, n, want;
+	u16 c, *map;
+
+	for (i = 0; i < CHAIN_MAPS; i++) {
+		if (chain_maps[i].count && chain_maps[i].first == first) {
+			*count = chain_maps[i].count;
+			return &chain_pool[chain_maps[i].offset];
+		}
+	}
+
+	want = (size + PAGE_SIZE * 8 - 1) / (PAGE_SIZE * 8);
+	if (want == 0)
+		want = 1;
+	if (want > CHAIN_POOL_SIZE ||
+	    first >= SFFS_CLUSTERS)
+		return NULL;
+
+	for (i = 0; i < CHAIN_MAPS; i++)
+		if (chain_maps[i].count == 0)
+			break;
+	if (i == CHAIN_MAPS || chain_pool_used + want > CHAIN_POOL_SIZE) {
+		chain_invalidate();
+		i = 0;
+	}
+
+	map = &chain_pool[chain_pool_used];
+	c = first;
+	for (n = 0; n < want; n++) {
+		map[n] = c;
+		c = cluster_next(c);
+		// end of chain or a bogus link
+		if (c >= SFFS_CLUSTERS)
+			break;
+	}
+	if (n < want)
+		n++;
+
+	chain_maps[i].first = first;
+	chain_maps[i].count = n;
+	chain_maps[i].offset = chain_pool_used;
+	chain_pool_used += n;
+
+	*count = n;
+	return map;
+}
+
+void nand_read_cluster(u32 pageno, u8 *buffer)
+{
+	nanddev_read(pageno, 8, buffer, NULL);
 }
 
 void nand_read_decrypted_cluster(u32 pageno, u8 *buffer)
 {
-	u8 iv[16] = {0,};
 	nand_read_cluster(pageno, buffer);
-
-	aes_reset();
-	aes_set_iv(iv);
-	aes_set_key(otp.nand_key);
-	aes_decrypt(buffer, buffer, 0x400, 0);
+	nanddev_decrypt_start(buffer, 0, NULL);
+	nanddev_decrypt_wait(buffer);
 }
 
-s32 nandfs_initialize(void)
+static u32 path_hash(u16 parent, const char *name, u32 len)
 {
+	u32 h = 2166136261u;
 	u32 i;
-	u32 supercluster = 0;
-	u32 supercluster_version = 0;
 
-	getotp(&otp);
+	h = (h ^ (parent & 0xff)) * 16777619u;
+	h = (h ^ (parent >> 8)) * 16777619u;
+	for (i = 0; i < len; i++)
+		h = (h ^ (u8)name[i]) * 16777619u;
+
+	return h & (NANDFS_HASH_SIZE - 1);
+}
+
+static s32 path_lookup(u16 parent, const char *name, u32 len)
+{
+	u16 i = hash_head[path_hash(parent, name, len)];
+
+	while (i != NANDFS_NONE) {
+		if (node_parent[i] == parent &&
+		    strnlen(fst_node(i)->name, NANDFS_NAME_LEN) == len &&
+		    strncmp(fst_node(i)->name, name, len) == 0)
+			return i;
+		i = hash_next[i];
+	}
+
+	return -1;
+}
+
+// index every node reachable from the root by (parent, name), walking the
+// directory tree breadth first. built on the first lookup after mount.
+static void path_index_build(void)
+{
+	u32 head = 0, tail = 0, steps;
+	u16 dir, i;
+	u32 h;
+	struct _nandfs_file_node *node;
+	u64 start;
+
+	if (index_ready)
+		return;
+
+	start = mftb();
+	index_nodes = 0;
+
+	// the walk touches most of the FST, fetch it in one go
+	sffs_load(sffs.sffs.files, sizeof(sffs.sffs.files));
+
+	memset(hash_head, 0xff, sizeof(hash_head));
+	memset(node_parent, 0xff, sizeof(node_parent));
+
+	node_parent[0] = 0;
+	dir_queue[tail++] = 0;
+
+	while (head < tail) {
+		dir = dir_queue[head++];
+		i = be16(fst_node(dir)->first_child);
 
-	nand_reset();
+		for (steps = 0; i < NANDFS_MAX_FILES && steps < NANDFS_MAX_FILES; steps++) {
+			node = fst_node(i);
+			// already linked somewhere else: corrupt FST, don't loop
+			if (node_parent[i] != NANDFS_NONE)
+				break;
+
+			h = path_hash(dir, node->name, strnlen(node->name, NANDFS_NAME_LEN));
+			node_parent[i] = dir;
+			hash_next[i] = hash_head[h];
+			hash_head[h] = i;
+			index_nodes++;
+
+			if ((node->attr & 3) == NANDFS_ATTR_DIR && tail < NANDFS_MAX_FILES)
+				dir_queue[tail++] = i;
+
+			i = be16(node->sibling);
+		}
+	}
+
+	index_ready = 1;
+	index_us = (mftb() - start) / TICKS_PER_USEC;
+}
 
-	for(i = 0x7F00; i < 0x7fff; i++) {
-		nand_read(i*8, sffs.buffer, NULL);
-		if(memcmp(sffs.sffs.magic, "SFFS", 4) != 0)
+s32 nandfs_initialize(void)
+{
+	u32 i, j, found = 0;
+	u32 slots[SFFS_SLOTS], versions[SFFS_SLOTS];
+	u32 pages[SFFS_SLOTS];
+	s32 status[SFFS_SLOTS];
+	struct _nandfs_sffs *sb;
+	u64 start = mftb();
+
+	nanddev_initialize();
+	cache_invalidate();
+	chain_invalidate();
+
+	// superblocks live in 16 slots of 16 clusters each at the end of the
+	// flash. fetch the first page of every slot in one go.
+	for(i = 0; i < SFFS_SLOTS; i++)
+		pages[i] = (SFFS_FIRST + i*16) * 8;
+	nanddev_read_list(pages, SFFS_SLOTS, sffs.buffer,
+		sffs.buffer + SFFS_SLOTS*PAGE_SIZE, status);
+
+	// order the valid slots newest generation first. a slot with a bad
+	// header page is skipped, so the previous generation takes over.
+	for(i = 0; i < SFFS_SLOTS; i++) {
+		sb = (struct _nandfs_sffs *)(sffs.buffer + i*PAGE_SIZE);
+
+		if(memcmp(sb->magic, "SFFS", 4) != 0)
 			continue;
-		if(supercluster == 0 ||
-		   sffs.sffs.version > supercluster_version) {
-			supercluster = i*8;
-			supercluster_version = sffs.sffs.version;
+		if(status[i] == NAND_ECC_UNCORRECTABLE) {
+			printf("nandfs: superblock %d (v%d) has ECC errors, skipping\n",
+				i, be32(sb->version));
+			continue;
+		}
+
+		for(j = found; j > 0 && versions[j-1] < be32(sb->version); j--) {
+			versions[j] = versions[j-1];
+			slots[j] = slots[j-1];
 		}
+		versions[j] = be32(sb->version);
+		slots[j] = i;
+		found++;
 	}
 
-	if(supercluster == 0) {
+	if(found == 0) {
 		printf("no supercluster found. "
 			     " your nand filesystem is seriously broken...\n");
 		return -1;
 	}
 
-	for(i = 0; i < 16; i++) {
-		printf("reading...\n");
-		nand_read_cluster(supercluster + i*8,
-				(sffs.buffer) + (i * PAGE_SIZE * 8));
+	for(i = 0; i < found; i++) {
+		// the scan used sffs as scratch space, nothing in it is valid yet
+		memset(sffs_loaded, 0, sizeof(sffs_loaded));
+		sffs_page0 = (SFFS_FIRST + slots[i]*16) * 8;
+		index_ready = 0;
+		index_nodes = 0;
+		index_us = 0;
+
+		if(strcmp(fst_node(0)->name, "/") == 0)
+			break;
+		printf("nandfs: superblock %d (v%d) has a corrupted FST\n",
+			slots[i], versions[i]);
+	}
+
+	if(i == found) {
+		printf("your nandfs is corrupted. fixit!\n");
+		return -1;
 	}
 
+	printf("nandfs: superblock at page %x, v%d, mounted in %u us\n",
+		sffs_page0, versions[i],
+		(u32)((mftb() - start) / TICKS_PER_USEC));
+
 	initialized = 1;
 	return 0;
 }
@@ -116,81 +429,148 @@ s32 nandfs_initialize(void)
 u32 nandfs_get_usage(void) {
 	u32 i;
 	int used_clusters = 0;
-	for (i=0; i < sizeof(sffs.sffs.cluster_table) / sizeof(u16); i++)
-		if(sffs.sffs.cluster_table[i] != NANDFS_FREE) used_clusters++;
+
+	sffs_load(sffs.sffs.cluster_table, sizeof(sffs.sffs.cluster_table));
+	for (i=0; i < SFFS_CLUSTERS; i++)
+		if(be16(sffs.sffs.cluster_table[i]) != NANDFS_FREE) used_clusters++;
 		
 	printf("Used clusters: %d\n", used_clusters);
-	return 1000 * used_clusters / (sizeof(sffs.sffs.cluster_table)/sizeof(u16));
+	return 1000 * used_clusters / SFFS_CLUSTERS;
 }
 
-s32 nandfs_open(struct nandfs_fp *fp, const char *path)
+// the root node is a directory whatever its attributes say
+static int is_dir(s32 node)
 {
-	char *ptr, *ptr2;
+	return node == 0 || (fst_node(node)->attr & 3) == NANDFS_ATTR_DIR;
+}
+
+// resolve an absolute path to its FST node, or -1
+static s32 nandfs_lookup(const char *path)
+{
+	const char *ptr, *end;
 	u32 len;
-	struct _nandfs_file_node *cur = sffs.sffs.files;
+	s32 cur = 0;
+
+	if (path[0] != '/')
+		return -1;
+
+	path_index_build();
+
+	ptr = path + 1;
+	while (*ptr) {
+		end = strchr(ptr, '/');
+		len = end ? (u32)(end - ptr) : strlen(ptr);
+		if (len == 0 || len > NANDFS_NAME_LEN) {
+			printf("invalid length: %s %s [%d]\n", ptr, path, len);
+			return -1;
+		}
+
+		if (!is_dir(cur))
+			return -1;
+
+		cur = path_lookup(cur, ptr, len);
+		if (cur < 0)
+			return -1;
+
+		if (!end)
+			break;
+		ptr = end + 1;
+	}
+
+	return cur;
+}
+
+s32 nandfs_open(struct nandfs_fp *fp, const char *path)
+{
+	struct _nandfs_file_node *cur;
+	s32 node;
 
 	if (initialized != 1)
 		return -1;
 
 	memset(fp, 0, sizeof(*fp));
 
-	if(strcmp(cur->name, "/") != 0) {
-		printf("your nandfs is corrupted. fixit!\n");
+	node = nandfs_lookup(path);
+	if (node < 0)
 		return -1;
-	}
 
-	cur = &sffs.sffs.files[cur->first_child];
-
-	ptr = (char *)path;
-	do {
-		ptr++;
-		ptr2 = strchr(ptr, '/');
-		if (ptr2 == NULL)
-			len = strlen(ptr);
-		else {
-			ptr2++;
-			len = ptr2 - ptr - 1;
-		}
-		if (len > 12)
-		{
-			printf("invalid length: %s %s %s [%d]\n",
-					ptr, ptr2, path, len);
+	cur = fst_node(node);
+	if ((cur->attr & 3) != NANDFS_ATTR_FILE)
+		return -1;
+
+	fp->first_cluster = be16(cur->first_cluster);
+	fp->cur_cluster = fp->first_cluster;
+	fp->offset = 0;
+	fp->size = be32(cur->size);
+	return 0;
+}
+
+static s32 walk_dir(u16 dir, char *path, u32 len, nandfs_walk_cb cb, void *arg)
+{
+	struct _nandfs_file_node *node;
+	u32 steps, n;
+	u16 i;
+	s32 ret;
+
+	i = be16(fst_node(dir)->first_child);
+	for (steps = 0; i < NANDFS_MAX_FILES && steps < NANDFS_MAX_FILES; steps++) {
+		node = fst_node(i);
+		if (node_parent[i] != dir)
+			break;
+
+		n = strnlen(node->name, NANDFS_NAME_LEN);
+		if (len + 1 + n >= NANDFS_PATH_LEN)
 			return -1;
+		path[len] = '/';
+		memcpy(path + len + 1, node->name, n);
+		path[len + 1 + n] = 0;
+
+		ret = cb(path, node->attr & 3, be32(node->size), arg);
+		if (ret)
+			return ret;
+
+		if ((node->attr & 3) == NANDFS_ATTR_DIR) {
+			ret = walk_dir(i, path, len + 1 + n, cb, arg);
+			if (ret)
+				return ret;
 		}
 
-		for (;;) {
-			if(ptr2 != NULL && strncmp(cur->name, ptr, len) == 0
-			     && strnlen(cur->name, 12) == len
-			     && (cur->attr&3) == 2
-			     && (s16)(cur->first_child&0xffff) != (s16)0xffff) {
-				cur = &sffs.sffs.files[cur->first_child];
-				ptr = ptr2-1;
-				break;
-			} else if(ptr2 == NULL &&
-				   strncmp(cur->name, ptr, len) == 0 &&
-				   strnlen(cur->name, 12) == len &&
-				   (cur->attr&3) == 1) {
-				break;
-			} else if((cur->sibling&0xffff) != 0xffff) {
-				cur = &sffs.sffs.files[cur->sibling];
-			} else {
-				return -1;
-			}
-		}
-		
-	} while(ptr2 != NULL);
+		i = be16(node->sibling);
+	}
 
-	fp->first_cluster = cur->first_cluster;
-	fp->cur_cluster = fp->first_cluster;
-	fp->offset = 0;
-	fp->size = cur->size;
+	path[len] = 0;
 	return 0;
 }
 
+s32 nandfs_walk(const char *path, nandfs_walk_cb cb, void *arg)
+{
+	char buf[NANDFS_PATH_LEN];
+	s32 node;
+	u32 len;
+
+	if (initialized != 1)
+		return -1;
+
+	node = nandfs_lookup(path);
+	if (node < 0 || !is_dir(node))
+		return -1;
+
+	len = strlcpy(buf, path, sizeof(buf));
+	if (len >= sizeof(buf))
+		return -1;
+	// "/" and "/foo/" both walk without a doubled separator
+	if (len > 0 && buf[len - 1] == '/')
+		buf[--len] = 0;
+
+	return walk_dir(node, buf, len, cb, arg);
+}
+
 s32 nandfs_read(void *ptr, u32 size, u32 nmemb, struct nandfs_fp *fp)
 {
 	u32 total = size*nmemb;
 	u32 copy_offset, copy_len;
+	s32 next;
+	int slot, ahead;
 
 	if (initialized != 1)
 		return -1;
@@ -201,23 +581,75 @@ s32 nandfs_read(void *ptr, u32 size, u32 nmemb, struct nandfs_fp *fp)
 	if (total == 0)
 		return 0;
 
+	ahead = -1;
 	while(total > 0) {
-		nand_read_decrypted_cluster(fp->cur_cluster*8, buffer);
 		copy_offset = fp->offset % (PAGE_SIZE * 8);
 		copy_len = (PAGE_SIZE * 8) - copy_offset;
 		if(copy_len > total)
 			copy_len = total;
-		memcpy(ptr, buffer + copy_offset, copy_len);
+
+		// the read-ahead of the previous round already fetched this one
+		slot = ahead;
+		if (slot < 0)
+			slot = cache_find(fp->cur_cluster);
+
+		if (slot >= 0 && cache[slot].state == CACHE_PLAIN) {
+			cache_hits++;
+			cache[slot].last_use = ++cache_clock;
+		} else if (slot >= 0) {
+			// fetched by a read-ahead, only the decryption is left
+			cache_prefetch_hits++;
+		} else {
+			cache_misses++;
+			slot = cache_victim(-1);
+			cache_claim(slot, fp->cur_cluster);
+			nand_read_cluster(fp->cur_cluster*8, cache_data[slot]);
+		}
+
+		ahead = -1;
+		if (cache[slot].state == CACHE_RAW) {
+			// decrypt this cluster and queue the read of the next one
+			// behind it, so the NAND read runs while we copy the
+			// plaintext out
+			next = cluster_next(fp->cur_cluster);
+			if (total > copy_len && cache_find(next) < 0) {
+				ahead = cache_victim(slot);
+				cache_claim(ahead, next);
+			}
+			nanddev_decrypt_start(cache_data[slot], next*8,
+				ahead >= 0 ? cache_data[ahead] : NULL);
+			nanddev_decrypt_wait(cache_data[slot]);
+			cache[slot].state = CACHE_PLAIN;
+		}
+
+		memcpy(ptr, cache_data[slot] + copy_offset, copy_len);
+		ptr = (u8 *)ptr + copy_len;
 		total -= copy_len;
 		fp->offset += copy_len;
 
 		if ((copy_offset + copy_len) >= (PAGE_SIZE * 8))
-			fp->cur_cluster = sffs.sffs.cluster_table[fp->cur_cluster];
+			fp->cur_cluster = cluster_next(fp->cur_cluster);
+
+		if (ahead >= 0)
+			nanddev_read_wait();
 	}
 
 	return size*nmemb;
 }
 
+void nandfs_cache_stats(u32 *hits, u32 *prefetch_hits, u32 *misses)
+{
+	*hits = cache_hits;
+	*prefetch_hits = cache_prefetch_hits;
+	*misses = cache_misses;
+}
+
+void nandfs_index_stats(u32 *nodes, u32 *build_us)
+{
+	*nodes = index_nodes;
+	*build_us = index_us;
+}
+
 s32 nandfs_seek(struct nandfs_fp *fp, s32 offset, u32 whence)
 {
 	if (initialized != 1)
@@ -249,13 +681,28 @@ s32 nandfs_seek(struct nandfs_fp *fp, s32 offset, u32 whence)
 		break;
 	}
 
-	int skip = fp->offset;
-	fp->cur_cluster = fp->first_cluster;
-	while (skip > (2048*8)) {
-		fp->cur_cluster = sffs.sffs.cluster_table[fp->cur_cluster];
-		skip -= 2048*8;
+	u32 idx = fp->offset / (PAGE_SIZE * 8);
+	u32 count;
+	u16 *map = chain_map(fp->first_cluster, fp->size, &count);
+
+	if (map) {
+		// seeking to the very end of a file that fills its last cluster
+		if (idx >= count)
+			idx = count - 1;
+		fp->cur_cluster = map[idx];
+		return 0;
 	}
 
+	// same clamp as above, the cluster after the last one is the end
+	// of chain marker
+	count = (fp->size + PAGE_SIZE * 8 - 1) / (PAGE_SIZE * 8);
+	if (count && idx >= count)
+		idx = count - 1;
+
+	fp->cur_cluster = fp->first_cluster;
+	while (idx--)
+		fp->cur_cluster = cluster_next(fp->cur_cluster);
+
 	return 0;
 }
 
@@ -12,11 +12,20 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #define __NANDFS_H__
 
 #define	NANDFS_NAME_LEN	12
+#define	NANDFS_PATH_LEN	64
+
+#define	NANDFS_ATTR_FILE	1
+#define	NANDFS_ATTR_DIR		2
 
 #define	NANDFS_SEEK_SET	0
 #define	NANDFS_SEEK_CUR	1
 #define	NANDFS_SEEK_END	2
 
+/* number of decrypted 16k clusters kept in MEM2 (at least 2) */
+#ifndef NANDFS_CACHE_CLUSTERS
+#define	NANDFS_CACHE_CLUSTERS	8
+#endif
+
 struct nandfs_fp {
 	s16 first_cluster;
 	s32 cur_cluster;
@@ -31,5 +40,19 @@ s32 nandfs_open(struct nandfs_fp *fp, const char *path);
 s32 nandfs_read(void *ptr, u32 size, u32 nmemb, struct nandfs_fp *fp);
 s32 nandfs_seek(struct nandfs_fp *fp, s32 offset, u32 whence);
 
+/* hits: cluster already decrypted, prefetch_hits: fetched by the
+   read-ahead, misses: had to be read from NAND */
+void nandfs_cache_stats(u32 *hits, u32 *prefetch_hits, u32 *misses);
+
+/* the path index is built by the first lookup after mount; both are 0
+   until then */
+void nandfs_index_stats(u32 *nodes, u32 *build_us);
+
+/* called for every node below the walked directory, parents first; a
+   nonzero return stops the walk and is passed back to the caller */
+typedef s32 (*nandfs_walk_cb)(const char *path, u8 attr, u32 size, void *arg);
+
+s32 nandfs_walk(const char *path, nandfs_walk_cb cb, void *arg);
+
 #endif
 
@@ -0,0 +1,88 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+	RAM disk block device
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "bootmii_ppc.h"
+#include "diskio.h"
+#include "ramdisk.h"
+#include "string.h"
+
+static u8 *ram;
+static u32 ram_sectors;
+static u32 ram_latency;
+
+static DSTATUS ramdisk_initialize(void)
+{
+	return ram ? 0 : STA_NOINIT | STA_NODISK;
+}
+
+static DSTATUS ramdisk_status(void)
+{
+	return ram ? 0 : STA_NOINIT | STA_NODISK;
+}
+
+static DRESULT ramdisk_read(BYTE *buff, DWORD sector, u32 count)
+{
+	if (sector >= ram_sectors || count > ram_sectors - sector)
+		return RES_PARERR;
+
+	if (ram_latency)
+		udelay(ram_latency);
+
+	memcpy(buff, ram + sector * 512, count * 512);
+	return RES_OK;
+}
+
+static DRESULT ramdisk_write(const BYTE *buff, DWORD sector, u32 count)
+{
+	if (sector >= ram_sectors || count > ram_sectors - sector)
+		return RES_PARERR;
+
+	if (ram_latency)
+		udelay(ram_latency);
+
+	memcpy(ram + sector * 512, buff, count * 512);
+	return RES_OK;
+}
+
+static DRESULT ramdisk_sync(void)
+{
+	return RES_OK;
+}
+
+static u32 ramdisk_sectors(void)
+{
+	return ram_sectors;
+}
+
+static const struct disk_ops ramdisk = {
+	.name		= "ram",
+	.initialize	= ramdisk_initialize,
+	.status		= ramdisk_status,
+	.read		= ramdisk_read,
+	.write		= ramdisk_write,
+	.sync		= ramdisk_sync,
+	.sectors	= ramdisk_sectors,
+};
+
+int ramdisk_init(void *mem, u32 sectors)
+{
+	ram = mem;
+	ram_sectors = sectors;
+
+	return disk_register(DISK_RAM, &ramdisk);
+}
+
+// stall every read and write call for us microseconds, so FatFs changes
+// can be compared on a fixed medium with roughly the cost of an IPC
+// round trip to the card
+void ramdisk_set_latency(u32 us)
+{
+	ram_latency = us;
+}
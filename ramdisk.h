@@ -0,0 +1,20 @@
+/*
+	BootMii - a Free Software replacement for the Nintendo/BroadOn bootloader.
+	Requires mini.
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __RAMDISK_H__
+#define __RAMDISK_H__
+
+#include "types.h"
+
+/* register mem as physical drive DISK_RAM; it has to be formatted with
+   f_mkfs before it can be mounted */
+int ramdisk_init(void *mem, u32 sectors);
+void ramdisk_set_latency(u32 us);
+
+#endif
+
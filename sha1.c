@@ -29,19 +29,10 @@ A million repetitions of "a"
 #define SHA_CMD_FLAG_ERR  (1<<29)
 #define SHA_CMD_AREA_BLOCK ((1<<10) - 1)
 
-typedef struct {
-	unsigned long state[5];
-	unsigned long count[2];
-	unsigned char buffer[64];
-} SHA1_CTX;
-
 typedef u32 sha1[5];
 
 static void SHA1Transform(unsigned long state[5], unsigned char buffer[64]);
 static void SHA1Transforml(unsigned long state[5], unsigned char buffer[64], u32 len);
-static void SHA1Init(SHA1_CTX* context);
-static void SHA1Update(SHA1_CTX* context, unsigned char* data, unsigned int len);
-static void SHA1Final(unsigned char digest[20], SHA1_CTX* context);
 
 static void SHA1Transform(unsigned long state[5], unsigned char buffer[64]) {
 	SHA1Transforml(state, buffer, 1);
@@ -96,7 +87,7 @@ static void SHA1Transforml(unsigned long state[5], unsigned char buffer[64], u32
 
 /* SHA1Init - Initialize new context */
 
-static void SHA1Init(SHA1_CTX* context)
+void SHA1Init(SHA1_CTX* context)
 {
 	// reset sha-1 engine
 	write32(SHA_CMD, read32(SHA_CMD) & ~(SHA_CMD_FLAG_EXEC));
@@ -114,7 +105,7 @@ static void SHA1Init(SHA1_CTX* context)
 
 /* Run your data through this. */
 
-static void SHA1Update(SHA1_CTX* context, unsigned char* data, unsigned int len)
+void SHA1Update(SHA1_CTX* context, unsigned char* data, unsigned int len)
 {
 	unsigned int i, j;
 
@@ -147,7 +138,7 @@ static void SHA1Update(SHA1_CTX* context, unsigned char* data, unsigned int len)
 
 /* Add padding and return the message digest. */
 
-static void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
+void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
 {
 	unsigned long i, j;
 	unsigned char finalcount[8];
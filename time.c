@@ -10,10 +10,6 @@ Copyright (C) 2008		Segher Boessenkool <segher@kernel.crashing.org>
 
 #include "bootmii_ppc.h"
 
-// Timebase frequency is bus frequency / 4.  Ignore roundoff, this
-// doesn't have to be very accurate.
-#define TICKS_PER_USEC (243/4)
-
 u64 mftb(void)
 {
   u32 hi, lo, dum;